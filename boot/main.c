@@ -1,5 +1,6 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/multiboot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -55,9 +56,11 @@ bootmain(void)
 		// as the physical address)
 		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
 
-	// call the entry point from the ELF header
+	// call the entry point from the ELF header, passing the memory
+	// map that boot.S collected the way a Multiboot loader would
 	// note: does not return!
-	((void (*)(void)) (ELFHDR->e_entry))();
+	asm volatile("jmp *%0" : : "r" (ELFHDR->e_entry),
+		     "a" (MULTIBOOT_BOOTLOADER_MAGIC), "b" (BOOT_MBINFO));
 
 bad:
 	outw(0x8A00, 0x8A00);
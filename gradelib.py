@@ -384,11 +384,19 @@ class Runner():
         TerminateTest when stop events occur.  The target_base
         argument gives the make target to run.  The make_args argument
         should be a list of additional arguments to pass to make.  The
-        timeout argument bounds how long to run before returning."""
-
-        def run_qemu_kw(target_base="qemu", make_args=[], timeout=30):
-            return target_base, make_args, timeout
-        target_base, make_args, timeout = run_qemu_kw(**kw)
+        timeout argument bounds how long to run before returning.  If
+        the icount argument is given, QEMU runs in deterministic mode:
+        its virtual clock, and with it the guest TSC, advances
+        2^icount ns per guest instruction rather than with host time,
+        so cycle counts measured in the guest repeat exactly."""
+
+        def run_qemu_kw(target_base="qemu", make_args=[], timeout=30,
+                        icount=None):
+            return target_base, make_args, timeout, icount
+        target_base, make_args, timeout, icount = run_qemu_kw(**kw)
+        if icount is not None:
+            make_args = make_args + [
+                "QEMUEXTRA+=-icount shift=%d,sleep=off" % icount]
 
         # Start QEMU
         pre_make()
@@ -414,9 +422,11 @@ class Runner():
             for m in self.__default_monitors + monitors:
                 m(self)
 
-            # Run and react
+            # Run and react, timing the guest until a monitor stops it
+            start = time.time()
             self.gdb.cont()
             self.__react(self.reactors, timeout)
+            self.elapsed = time.time() - start
         finally:
             # Shutdown QEMU
             try:
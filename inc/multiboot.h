@@ -0,0 +1,57 @@
+#ifndef JOS_INC_MULTIBOOT_H
+#define JOS_INC_MULTIBOOT_H
+
+// <inc/multiboot.h>
+// The parts of the Multiboot specification that JOS uses to learn the
+// physical memory map from its boot loader.  boot/boot.S builds the
+// same structures from the BIOS's E820 map, so the kernel reads the
+// map the same way whichever loader started it.
+
+// In %eax when a Multiboot boot loader enters the kernel; %ebx then
+// holds the physical address of a struct MultibootInfo.
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+// mbi_flags bits
+#define MULTIBOOT_INFO_MEMORY	0x00000001	// mbi_mem_lower/upper valid
+#define MULTIBOOT_INFO_MEM_MAP	0x00000040	// mbi_mmap_* valid
+
+// mm_type of usable RAM
+#define MULTIBOOT_MEMORY_AVAILABLE	1
+
+// Where boot/boot.S builds the info structure and the memory map
+#define BOOT_MBINFO	0x500
+#define BOOT_MMAP	0x600
+#define BOOT_MMAP_MAX	64	// most entries it collects
+#define BOOT_MMAP_ESIZE	24	// bytes per entry, including mm_size
+
+// Field offsets in struct MultibootInfo, for assembly
+#define MBI_FLAGS	0
+#define MBI_MMAP_LENGTH	44
+#define MBI_MMAP_ADDR	48
+
+#ifndef __ASSEMBLER__
+
+struct MultibootInfo {
+	uint32_t mbi_flags;
+	uint32_t mbi_mem_lower;		// KB of memory below 1MB
+	uint32_t mbi_mem_upper;		// KB from 1MB to the first hole
+	uint32_t mbi_boot_device;
+	uint32_t mbi_cmdline;
+	uint32_t mbi_mods_count;
+	uint32_t mbi_mods_addr;
+	uint32_t mbi_syms[4];
+	uint32_t mbi_mmap_length;	// size of the memory map in bytes
+	uint32_t mbi_mmap_addr;		// physical address of the map
+};
+
+// A memory map entry.  The next one starts mm_size + 4 bytes later.
+struct MultibootMmap {
+	uint32_t mm_size;
+	uint64_t mm_addr;
+	uint64_t mm_len;
+	uint32_t mm_type;
+} __attribute__((packed));
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_MULTIBOOT_H */
@@ -0,0 +1,53 @@
+#ifndef JOS_INC_SYMIDX_H
+#define JOS_INC_SYMIDX_H
+
+// <inc/symidx.h>
+// Compact kernel symbol index
+
+// At build time kern/mksymidx.c converts the kernel's STABS into a
+// compact address-to-function/line index, which the kernel links into
+// its .symidx section in place of the raw stabs.  debuginfo_eip() finds
+// the function with a binary search over a dense address array, then
+// decodes that function's short, delta-encoded line program.
+//
+// This header is shared with the host tool, so like <inc/elf.h> it
+// uses only fixed-width types and includes nothing itself.
+
+#define SYMIDX_MAGIC	0x32444953U	/* "SID2" in little endian */
+
+// sf_file value for a range that lies outside every source file
+#define SYMIDX_NOFILE	0xFFFF
+
+// The .symidx section starts with this header, followed by:
+//	uint32_t		addrs[si_nfun];	   range start addresses, sorted
+//	struct SymidxFun	funs[si_nfun];	   per-range information
+//	uint32_t		files[si_nfile];   string offsets of file names
+//	uint8_t			lines[si_linesz];  line programs
+//	char			strtab[si_strsz];  NUL-terminated names
+struct Symidx {
+	uint32_t si_magic;	// must equal SYMIDX_MAGIC
+	uint32_t si_nfun;	// number of address ranges
+	uint32_t si_nfile;	// number of file table entries
+	uint32_t si_linesz;	// size of the line programs in bytes
+	uint32_t si_strsz;	// size of the string table in bytes
+};
+
+// An address range extends from addrs[i] up to addrs[i+1].  Ranges with
+// no enclosing function (assembly files, gaps between functions) have
+// sf_name == 0, which is the empty string.
+struct SymidxFun {
+	uint32_t sf_lines;	// offset of this range's line program
+	uint32_t sf_name;	// strtab offset of the function name
+	uint16_t sf_file;	// file table index, or SYMIDX_NOFILE
+	uint16_t sf_narg;	// number of function arguments
+};
+
+// A range's line program runs up to the next range's sf_lines.  It is a
+// sequence of rows, each starting at a higher address than the last:
+//	uleb128  (address delta << 1) | new-file flag
+//	uleb128  new file table index, if the flag is set
+//	sleb128  line number delta
+// Decoding starts at the range's start address, line 0, and the range's
+// sf_file.
+
+#endif /* !JOS_INC_SYMIDX_H */
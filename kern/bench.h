@@ -0,0 +1,11 @@
+#ifndef JOS_KERN_BENCH_H
+#define JOS_KERN_BENCH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#define BENCH_ITERS	256	// runs of each benchmark
+
+void bench_run(void);
+
+#endif	// !JOS_KERN_BENCH_H
@@ -7,6 +7,8 @@
 #include <inc/assert.h>
 
 #include <kern/console.h>
+#include <kern/trace.h>
+#include <kern/pmap.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -400,6 +402,7 @@ cons_intr(int (*proc)(void))
 	while ((c = (*proc)()) != -1) {
 		if (c == 0)
 			continue;
+		TRACEPOINT(cons_intr, c);
 		cons.buf[cons.wpos++] = c;
 		if (cons.wpos == CONSBUFSIZE)
 			cons.wpos = 0;
@@ -463,8 +466,10 @@ getchar(void)
 {
 	int c;
 
+	// Waiting for a key is idle time: spend it zeroing free pages
+	// for page_alloc(ALLOC_ZERO).
 	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+		page_zero_idle();
 	return c;
 }
 
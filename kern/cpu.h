@@ -0,0 +1,19 @@
+#ifndef JOS_INC_CPU_H
+#define JOS_INC_CPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+// Maximum number of CPUs.  The kernel runs on the boot CPU only for
+// now, but per-CPU data is already indexed by cpunum() so that it
+// carries over when the other CPUs are brought up.
+#define NCPU  1
+
+// The ID of the CPU we are running on.
+static inline int
+cpunum(void)
+{
+	return 0;
+}
+
+#endif
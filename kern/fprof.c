@@ -0,0 +1,188 @@
+// Deterministic per-function cycle accounting.
+//
+// When the kernel is built with 'make KPROF=1', gcc's
+// -finstrument-functions makes every kernel function call
+// __cyg_profile_func_enter() on entry and __cyg_profile_func_exit() on
+// return.  These hooks keep a call count and inclusive and exclusive
+// TSC cycle totals per function, in a hash table keyed by function
+// address.  This file and the inline functions in inc/ are not
+// instrumented (see kern/Makefrag), so the hooks never recurse.
+//
+// In a normal build the hooks are never called and 'fprof' reports
+// nothing.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/fprof.h>
+#include <kern/kdebug.h>
+
+struct FprofFunc {
+	uintptr_t ff_addr;		// function address, 0 if slot free
+	uint64_t ff_calls;
+	uint64_t ff_incl;		// cycles including callees
+	uint64_t ff_excl;		// cycles in the function itself
+};
+
+// A call in progress
+struct FprofFrame {
+	struct FprofFunc *fr_func;
+	uint64_t fr_start;		// TSC at entry
+	uint64_t fr_callees;		// cycles spent in callees so far
+};
+
+static struct FprofFunc fprof_funcs[FPROF_NFUNCS];
+static struct FprofFrame fprof_stack[FPROF_DEPTH];
+static int fprof_depth;
+static int fprof_overflow;		// calls deeper than FPROF_DEPTH
+static uint32_t fprof_full;		// calls not counted, table full
+static bool fprof_on;
+
+void __cyg_profile_func_enter(void *fn, void *site);
+void __cyg_profile_func_exit(void *fn, void *site);
+
+// Start accounting.  Called once the BSS is cleared, so that nothing
+// the hooks record before then is wiped out under them.
+void
+fprof_init(void)
+{
+	fprof_on = 1;
+}
+
+// Zero all counts.  Calls in progress keep their table entries, so
+// their exits are still accounted correctly.
+void
+fprof_reset(void)
+{
+	uint32_t eflags = read_eflags();
+	int i;
+
+	asm volatile("cli");
+	for (i = 0; i < FPROF_NFUNCS; i++) {
+		fprof_funcs[i].ff_calls = 0;
+		fprof_funcs[i].ff_incl = 0;
+		fprof_funcs[i].ff_excl = 0;
+	}
+	fprof_full = 0;
+	write_eflags(eflags);
+}
+
+static struct FprofFunc *
+fprof_lookup(uintptr_t addr)
+{
+	uint32_t i, h = (addr >> 2) * 2654435761U;
+	struct FprofFunc *f;
+
+	for (i = 0; i < FPROF_NFUNCS; i++) {
+		f = &fprof_funcs[(h + i) & (FPROF_NFUNCS - 1)];
+		if (f->ff_addr == addr)
+			return f;
+		if (f->ff_addr == 0) {
+			f->ff_addr = addr;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+void
+__cyg_profile_func_enter(void *fn, void *site)
+{
+	uint32_t eflags;
+	struct FprofFunc *f;
+	struct FprofFrame *fr;
+
+	if (!fprof_on)
+		return;
+	// An interrupt handler is instrumented too, so keep it from
+	// running in the middle of an update.
+	eflags = read_eflags();
+	asm volatile("cli");
+
+	if (fprof_depth == FPROF_DEPTH) {
+		fprof_overflow++;
+	} else {
+		if ((f = fprof_lookup((uintptr_t) fn)) != NULL)
+			f->ff_calls++;
+		else
+			fprof_full++;
+		fr = &fprof_stack[fprof_depth++];
+		fr->fr_func = f;
+		fr->fr_callees = 0;
+		fr->fr_start = read_tsc();
+	}
+
+	write_eflags(eflags);
+}
+
+void
+__cyg_profile_func_exit(void *fn, void *site)
+{
+	uint64_t now = read_tsc(), elapsed;
+	uint32_t eflags;
+	struct FprofFrame *fr;
+
+	if (!fprof_on)
+		return;
+	eflags = read_eflags();
+	asm volatile("cli");
+
+	if (fprof_overflow > 0) {
+		fprof_overflow--;
+	} else if (fprof_depth > 0) {
+		// Calls that began before fprof_init() leave the stack
+		// empty here and are ignored.
+		fr = &fprof_stack[--fprof_depth];
+		elapsed = now - fr->fr_start;
+		if (fr->fr_func) {
+			fr->fr_func->ff_incl += elapsed;
+			fr->fr_func->ff_excl += elapsed - fr->fr_callees;
+		}
+		if (fprof_depth > 0)
+			fprof_stack[fprof_depth - 1].fr_callees += elapsed;
+	}
+
+	write_eflags(eflags);
+}
+
+// Print the 'top' functions with the most exclusive cycles.  Recursive
+// calls count toward a function's inclusive total once per level.
+void
+fprof_report(int top)
+{
+	struct FprofFunc *best;
+	struct Eipdebuginfo info;
+	static bool shown[FPROF_NFUNCS];
+	bool was_on = fprof_on;
+	int i, j;
+
+	// Don't account for the report itself.
+	fprof_on = 0;
+	memset(shown, 0, sizeof(shown));
+
+	cprintf("      calls   incl cycles   excl cycles  excl/call  function\n");
+	for (i = 0; i < top; i++) {
+		best = NULL;
+		for (j = 0; j < FPROF_NFUNCS; j++)
+			if (fprof_funcs[j].ff_calls && !shown[j]
+			    && (!best || fprof_funcs[j].ff_excl > best->ff_excl))
+				best = &fprof_funcs[j];
+		if (!best)
+			break;
+		shown[best - fprof_funcs] = 1;
+		debuginfo_eip(best->ff_addr, &info);
+		cprintf("%11llu %13llu %13llu %10llu  %.*s\n",
+			best->ff_calls, best->ff_incl, best->ff_excl,
+			best->ff_excl / best->ff_calls,
+			info.eip_fn_namelen, info.eip_fn_name);
+	}
+	if (i == 0)
+		cprintf("(no calls recorded; build the kernel with 'make KPROF=1')\n");
+	if (fprof_full)
+		cprintf("(%u calls to functions not counted: table full)\n",
+			fprof_full);
+
+	fprof_on = was_on;
+}
@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_FPROF_H
+#define JOS_KERN_FPROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#define FPROF_NFUNCS	1024	// hash table size; must be a power of 2
+#define FPROF_DEPTH	64	// deepest call chain tracked
+
+void fprof_init(void);
+void fprof_reset(void);
+void fprof_report(int top);
+
+#endif	// !JOS_KERN_FPROF_H
@@ -1,11 +1,18 @@
 /* See COPYRIGHT for copyright information. */
 
 #include <inc/stdio.h>
+#include <inc/x86.h>
 #include <inc/string.h>
 #include <inc/assert.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/fprof.h>
+#include <kern/bench.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -19,8 +26,10 @@ test_backtrace(int x)
 	cprintf("leaving test_backtrace %d\n", x);
 }
 
+// Called from entry.S with the values a Multiboot boot loader passes
+// in %eax and %ebx.
 void
-i386_init(void)
+i386_init(uint32_t mbmagic, physaddr_t mbinfo)
 {
 	extern char edata[], end[];
 
@@ -29,15 +38,41 @@ i386_init(void)
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
 
+	// Per-function accounting, in 'make KPROF=1' kernels.
+	fprof_init();
+
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	// Lab 2 memory management initialization functions
+	mem_init(mbmagic, mbinfo);
+	kmem_init();
+
+	// Trap and interrupt controller initialization.  Interrupts stay
+	// masked until something, like the profiler, turns them on.
+	trap_init();
+	pic_init();
+
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
 
+#ifdef KBENCH
+	// Run the in-guest benchmarks for grade-perf.
+	bench_run();
+#endif
+
+#ifdef KBOOTTIME
+	// Boot latency stamps for bench-boot
+	{
+		extern uint64_t entry_tsc;
+		cprintf("boot: kernel entry at tsc %llu, monitor at tsc %llu\n",
+			entry_tsc, read_tsc());
+	}
+#endif
+
 	// Drop into the kernel monitor.
 	while (1)
 		monitor(NULL);
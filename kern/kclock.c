@@ -0,0 +1,38 @@
+/* See COPYRIGHT for copyright information. */
+
+/* Support for the 8253 programmable interval timer and the
+ * MC146818 real time clock's NVRAM. */
+
+#include <inc/x86.h>
+#include <inc/trap.h>
+
+#include <kern/kclock.h>
+#include <kern/picirq.h>
+
+
+// Start the 8253 generating timer interrupts (IRQ 0) 'hz' times a
+// second, clamped to what the timer can do, and unmask them.
+void
+kclock_start(int hz)
+{
+	hz = MAX(TIMER_MINHZ, MIN(hz, TIMER_MAXHZ));
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+	outb(IO_TIMER1, TIMER_DIV(hz) % 256);
+	outb(IO_TIMER1, TIMER_DIV(hz) / 256);
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_TIMER));
+}
+
+// Mask timer interrupts again.
+void
+kclock_stop(void)
+{
+	irq_setmask_8259A(irq_mask_8259A | (1<<IRQ_TIMER));
+}
+
+
+unsigned
+mc146818_read(unsigned reg)
+{
+	outb(IO_RTC, reg);
+	return inb(IO_RTC+1);
+}
@@ -1,96 +1,108 @@
-#include <inc/stab.h>
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/symidx.h>
 
 #include <kern/kdebug.h>
 
-extern const struct Stab __STAB_BEGIN__[];	// Beginning of stabs table
-extern const struct Stab __STAB_END__[];	// End of stabs table
-extern const char __STABSTR_BEGIN__[];		// Beginning of string table
-extern const char __STABSTR_END__[];		// End of string table
+extern const char __SYMIDX_BEGIN__[];		// Beginning of symbol index
+extern const char __SYMIDX_END__[];		// End of symbol index
+extern char bootstack[], bootstacktop[];	// Kernel stack (entry.S)
 
+// The decoded sections of the symbol index
+static struct {
+	int valid;			// index has been checked
+	uint32_t nfun;
+	const uint32_t *addrs;
+	const struct SymidxFun *funs;
+	uint32_t nfile;
+	const uint32_t *files;
+	const uint8_t *lines;
+	uint32_t linesz;
+	const char *strtab;
+	uint32_t strsz;
+} symidx;
 
-// stab_binsearch(stabs, region_left, region_right, type, addr)
-//
-//	Some stab types are arranged in increasing order by instruction
-//	address.  For example, N_FUN stabs (stab entries with n_type ==
-//	N_FUN), which mark functions, and N_SO stabs, which mark source files.
-//
-//	Given an instruction address, this function finds the single stab
-//	entry of type 'type' that contains that address.
-//
-//	The search takes place within the range [*region_left, *region_right].
-//	Thus, to search an entire set of N stabs, you might do:
-//
-//		left = 0;
-//		right = N - 1;     /* rightmost stab */
-//		stab_binsearch(stabs, &left, &right, type, addr);
-//
-//	The search modifies *region_left and *region_right to bracket the
-//	'addr'.  *region_left points to the matching stab that contains
-//	'addr', and *region_right points just before the next stab.  If
-//	*region_left > *region_right, then 'addr' is not contained in any
-//	matching stab.
+
+// symidx_init()
 //
-//	For example, given these N_SO stabs:
-//		Index  Type   Address
-//		0      SO     f0100000
-//		13     SO     f0100040
-//		117    SO     f0100176
-//		118    SO     f0100178
-//		555    SO     f0100652
-//		556    SO     f0100654
-//		657    SO     f0100849
-//	this code:
-//		left = 0, right = 657;
-//		stab_binsearch(stabs, &left, &right, N_SO, 0xf0100184);
-//	will exit setting left = 118, right = 554.
+//	Locate the tables of the kernel's symbol index (see <inc/symidx.h>).
+//	Returns 0 on success, or -1 if this kernel was linked without a
+//	valid index.  The first of the two kernel links has none; it only
+//	exists to feed mksymidx.
 //
-static void
-stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
-	       int type, uintptr_t addr)
+static int
+symidx_init(void)
 {
-	int l = *region_left, r = *region_right, any_matches = 0;
+	const struct Symidx *si = (const struct Symidx *) __SYMIDX_BEGIN__;
+	size_t size = __SYMIDX_END__ - __SYMIDX_BEGIN__;
 
-	while (l <= r) {
-		int true_m = (l + r) / 2, m = true_m;
+	if (symidx.valid)
+		return 0;
+	if (size < sizeof(*si) || si->si_magic != SYMIDX_MAGIC
+	    || size < sizeof(*si)
+		      + si->si_nfun * (sizeof(uint32_t) + sizeof(struct SymidxFun))
+		      + si->si_nfile * sizeof(uint32_t)
+		      + si->si_linesz + si->si_strsz
+	    || si->si_strsz == 0)
+		return -1;
 
-		// search for earliest stab with right type
-		while (m >= l && stabs[m].n_type != type)
-			m--;
-		if (m < l) {	// no match in [l, m]
-			l = true_m + 1;
-			continue;
-		}
+	symidx.nfun = si->si_nfun;
+	symidx.addrs = (const uint32_t *) (si + 1);
+	symidx.funs = (const struct SymidxFun *) (symidx.addrs + si->si_nfun);
+	symidx.nfile = si->si_nfile;
+	symidx.files = (const uint32_t *) (symidx.funs + si->si_nfun);
+	symidx.lines = (const uint8_t *) (symidx.files + si->si_nfile);
+	symidx.linesz = si->si_linesz;
+	symidx.strtab = (const char *) (symidx.lines + si->si_linesz);
+	symidx.strsz = si->si_strsz;
+	// String table validity check
+	if (symidx.strtab[symidx.strsz - 1] != 0)
+		return -1;
+	symidx.valid = 1;
+	return 0;
+}
 
-		// actual binary search
-		any_matches = 1;
-		if (stabs[m].n_value < addr) {
-			*region_left = m;
-			l = true_m + 1;
-		} else if (stabs[m].n_value > addr) {
-			*region_right = m - 1;
-			r = m - 1;
-		} else {
-			// exact match for 'addr', but continue loop to find
-			// *region_right
-			*region_left = m;
-			l = m;
-			addr++;
-		}
+static const char *
+symidx_str(uint32_t off)
+{
+	return off < symidx.strsz ? symidx.strtab + off : NULL;
+}
+
+// Decode one unsigned or signed LEB128 number from the line program.
+static uint32_t
+read_uleb(const uint8_t **p, const uint8_t *end)
+{
+	uint32_t v = 0;
+	int shift = 0;
+
+	while (*p < end) {
+		uint8_t b = *(*p)++;
+		v |= (uint32_t) (b & 0x7f) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			break;
 	}
+	return v;
+}
+
+static int32_t
+read_sleb(const uint8_t **p, const uint8_t *end)
+{
+	int32_t v = 0;
+	int shift = 0;
+	uint8_t b = 0;
 
-	if (!any_matches)
-		*region_right = *region_left - 1;
-	else {
-		// find rightmost region containing 'addr'
-		for (l = *region_right;
-		     l > *region_left && stabs[l].n_type != type;
-		     l--)
-			/* do nothing */;
-		*region_left = l;
+	while (*p < end) {
+		b = *(*p)++;
+		v |= (int32_t) (b & 0x7f) << shift;
+		shift += 7;
+		if (!(b & 0x80))
+			break;
 	}
+	if (shift < 32 && (b & 0x40))
+		v |= -(1 << shift);
+	return v;
 }
 
 
@@ -104,9 +116,12 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 {
-	const struct Stab *stabs, *stab_end;
-	const char *stabstr, *stabstr_end;
-	int lfile, rfile, lfun, rfun, lline, rline;
+	const struct SymidxFun *fun;
+	const uint8_t *p, *end;
+	uint32_t row_addr, v;
+	uint16_t file, line_file;
+	int l, r, m, line, found;
+	const char *s;
 
 	// Initialize *info
 	info->eip_file = "<unknown>";
@@ -116,97 +131,143 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	info->eip_fn_addr = addr;
 	info->eip_fn_narg = 0;
 
-	// Find the relevant set of stabs
-	if (addr >= ULIM) {
-		stabs = __STAB_BEGIN__;
-		stab_end = __STAB_END__;
-		stabstr = __STABSTR_BEGIN__;
-		stabstr_end = __STABSTR_END__;
-	} else {
+	if (addr < ULIM) {
 		// Can't search for user-level addresses yet!
-  	        panic("User address");
+		panic("User address");
 	}
+	if (symidx_init() < 0)
+		return -1;
 
-	// String table validity checks
-	if (stabstr_end <= stabstr || stabstr_end[-1] != 0)
+	// Binary search for the last range starting at or before 'addr'.
+	l = 0;
+	r = symidx.nfun;
+	while (l < r) {
+		m = (l + r) / 2;
+		if (symidx.addrs[m] <= addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	if (l == 0)
+		return -1;
+	m = l - 1;
+	fun = &symidx.funs[m];
+	if (fun->sf_file == SYMIDX_NOFILE)
 		return -1;
 
-	// Now we find the right stabs that define the function containing
-	// 'eip'.  First, we find the basic source file containing 'eip'.
-	// Then, we look in that source file for the function.  Then we look
-	// for the line number.
+	// Ranges without a name lie outside any function, for instance
+	// in an assembly file.
+	if (fun->sf_name != 0 && (s = symidx_str(fun->sf_name)) != NULL) {
+		info->eip_fn_name = s;
+		info->eip_fn_namelen = strlen(s);
+		info->eip_fn_addr = symidx.addrs[m];
+		info->eip_fn_narg = fun->sf_narg;
+	}
 
-	// Search the entire set of stabs for the source file (type N_SO).
-	lfile = 0;
-	rfile = (stab_end - stabs) - 1;
-	stab_binsearch(stabs, &lfile, &rfile, N_SO, addr);
-	if (lfile == 0)
+	// Run the range's line program up to the last row at or before
+	// 'addr'.  Rows are in increasing address order.
+	p = symidx.lines + MIN(fun->sf_lines, symidx.linesz);
+	end = symidx.lines + (m + 1 < symidx.nfun
+			      ? MIN(symidx.funs[m + 1].sf_lines, symidx.linesz)
+			      : symidx.linesz);
+	row_addr = symidx.addrs[m];
+	line = 0;
+	file = fun->sf_file;
+	line_file = file;
+	found = 0;
+	while (p < end) {
+		v = read_uleb(&p, end);
+		row_addr += v >> 1;
+		if (v & 1)
+			file = read_uleb(&p, end);
+		line += read_sleb(&p, end);
+		if (row_addr > addr)
+			break;
+		info->eip_line = line;
+		line_file = file;
+		found = 1;
+	}
+	if (!found)
 		return -1;
 
-	// Search within that file's stabs for the function definition
-	// (N_FUN).
-	lfun = lfile;
-	rfun = rfile;
-	stab_binsearch(stabs, &lfun, &rfun, N_FUN, addr);
-
-	if (lfun <= rfun) {
-		// stabs[lfun] points to the function name
-		// in the string table, but check bounds just in case.
-		if (stabs[lfun].n_strx < stabstr_end - stabstr)
-			info->eip_fn_name = stabstr + stabs[lfun].n_strx;
-		info->eip_fn_addr = stabs[lfun].n_value;
-		addr -= info->eip_fn_addr;
-		// Search within the function definition for the line number.
-		lline = lfun;
-		rline = rfun;
-	} else {
-		// Couldn't find function stab!  Maybe we're in an assembly
-		// file.  Search the whole file for the line number.
-		info->eip_fn_addr = addr;
-		lline = lfile;
-		rline = rfile;
-	}
-	// Ignore stuff after the colon.
-	info->eip_fn_namelen = strfind(info->eip_fn_name, ':') - info->eip_fn_name;
-
-
-	// Search within [lline, rline] for the line number stab.
-	// If found, set info->eip_line to the right line number.
-	// If not found, return -1.
-	//
-	// Hint:
-	//	There's a particular stabs type used for line numbers.
-	//	Look at the STABS documentation and <inc/stab.h> to find
-	//	which one.
-	// Your code here.
-	stab_binsearch(stabs, &lline, &rline, N_SLINE, addr);
-	
-	if (lline <= rline) {
-		info->eip_line = stabs[rline].n_desc;
-	} else {
+	// The line may come from an #included file rather than the
+	// range's own file.
+	if (line_file < symidx.nfile
+	    && (s = symidx_str(symidx.files[line_file])) != NULL)
+		info->eip_file = s;
+	return 0;
+}
+
+// debuginfo_fn(name, addr)
+//
+//	Find the function called 'name' and store its entry address in
+//	'*addr'.  If several static functions share the name, the one
+//	at the lowest address is found.  Returns 0 on success, or -1 if
+//	there is no such function.
+//
+int
+debuginfo_fn(const char *name, uintptr_t *addr)
+{
+	const char *s;
+	uint32_t i;
+
+	if (symidx_init() < 0)
 		return -1;
+	for (i = 0; i < symidx.nfun; i++)
+		if (symidx.funs[i].sf_name != 0
+		    && (s = symidx_str(symidx.funs[i].sf_name)) != NULL
+		    && strcmp(s, name) == 0) {
+			*addr = symidx.addrs[i];
+			return 0;
+		}
+	return -1;
+}
+
+
+// stack_bounds(ebp, lo, hi)
+//
+//	Find the kernel stack containing 'ebp' and store its bounds in
+//	[*lo, *hi).  Returns 0 on success, or -1 if 'ebp' is not inside
+//	any known kernel stack.
+//
+static int
+stack_bounds(uintptr_t ebp, uintptr_t *lo, uintptr_t *hi)
+{
+	if (ebp >= (uintptr_t) bootstack && ebp < (uintptr_t) bootstacktop) {
+		*lo = (uintptr_t) bootstack;
+		*hi = (uintptr_t) bootstacktop;
+		return 0;
 	}
+	return -1;
+}
 
-	// Search backwards from the line number for the relevant filename
-	// stab.
-	// We can't just use the "lfile" stab because inlined functions
-	// can interpolate code from a different file!
-	// Such included source files use the N_SOL stab type.
-	while (lline >= lfile
-	       && stabs[lline].n_type != N_SOL
-	       && (stabs[lline].n_type != N_SO || !stabs[lline].n_value))
-		lline--;
-	if (lline >= lfile && stabs[lline].n_strx < stabstr_end - stabstr)
-		info->eip_file = stabstr + stabs[lline].n_strx;
-
-
-	// Set eip_fn_narg to the number of arguments taken by the function,
-	// or 0 if there was no containing function.
-	if (lfun < rfun)
-		for (lline = lfun + 1;
-		     lline < rfun && stabs[lline].n_type == N_PSYM;
-		     lline++)
-			info->eip_fn_narg++;
+// stack_capture(pcs, max, ebp)
+//
+//	Walk the chain of saved frame pointers starting at 'ebp' and store
+//	the return address of each frame in 'pcs', up to 'max' of them.
+//	Returns the number of addresses stored.  This does no symbol
+//	lookup, so it is cheap enough for profilers and tracers; pass the
+//	result to debuginfo_eip() later to symbolise it.
+//
+//	The walk stays inside the stack that 'ebp' points into, and each
+//	frame must lie above the previous one, so it ends after at most
+//	'max' steps even if the stack is corrupt.
+//
+int
+stack_capture(uint32_t *pcs, int max, uint32_t ebp)
+{
+	uintptr_t lo, hi;
+	uint32_t *frame;
+	int n = 0;
 
-	return 0;
+	if (stack_bounds(ebp, &lo, &hi) < 0)
+		return 0;
+	while (n < max && ebp >= lo && ebp <= hi - 8 && (ebp & 3) == 0) {
+		frame = (uint32_t *) ebp;
+		pcs[n++] = frame[1];
+		if (frame[0] <= ebp)
+			break;
+		ebp = frame[0];
+	}
+	return n;
 }
@@ -16,5 +16,7 @@ struct Eipdebuginfo {
 };
 
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_fn(const char *name, uintptr_t *addr);
+int stack_capture(uint32_t *pcs, int max, uint32_t ebp);
 
 #endif
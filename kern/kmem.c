@@ -0,0 +1,444 @@
+// Slab allocator.
+//
+// A cache's slabs are blocks of 2^kc_order pages from
+// page_alloc_order(), which aligns each block to its size, so the slab
+// holding an object is found by rounding the object's address down.
+// A slab starts with a struct Slab and its stack of free object
+// indices, then a colour offset, then the objects.  Successive slabs
+// get successive colour offsets, so that objects at the same index in
+// different slabs fall in different cache sets.
+//
+// Each CPU has a small hot cache of free objects in front of the
+// slabs, so most allocations and frees are a pop or a push.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/kmem.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+
+#define KMEM_MAX_ORDER	3	// biggest slab, in 2^order pages
+#define KMEM_MIN_OBJS	8	// slabs grow until this many objects fit
+#define KMEM_COLOUR	64	// colour step: one cache line
+
+struct Slab {
+	struct Slab *sl_next;		// on the partial, full or empty list
+	struct Slab **sl_pprev;
+	char *sl_objs;			// first object
+	uint16_t sl_inuse;		// objects handed out
+	uint16_t sl_nfree;		// entries in sl_free
+	uint16_t sl_free[];		// indices of the free objects
+};
+
+struct KmemCpu {
+	int kcc_count;
+	void *kcc_objs[KMEM_CPU_SIZE];
+};
+
+struct KmemCache {
+	char kc_name[KMEM_NAMELEN];
+	size_t kc_size;			// object size, a multiple of kc_align
+	size_t kc_align;
+	void (*kc_ctor)(void *);
+
+	// Slab layout
+	int kc_order;			// slabs are 2^kc_order pages
+	int kc_nobjs;			// objects per slab
+	size_t kc_offset;		// first object, before colouring
+	size_t kc_colour_step;
+	int kc_ncolours;
+	int kc_colour;			// colour of the next slab
+
+	struct Slab *kc_partial;	// slabs with free and used objects
+	struct Slab *kc_full;
+	struct Slab *kc_empty;		// at most one, kept for reuse
+	struct KmemCpu kc_cpu[NCPU];
+
+	// Statistics
+	uint32_t kc_nslabs;
+	uint32_t kc_inuse;		// objects out of the slabs
+	uint32_t kc_allocs;
+	uint32_t kc_hits;		// allocations from a hot cache
+	uint32_t kc_grows;		// slabs created
+	uint32_t kc_reaps;		// slabs given back
+
+	struct KmemCache *kc_next;	// on kmem_caches
+};
+
+// The cache that kmem_cache_create() allocates caches from
+static struct KmemCache kmem_cache_cache;
+static struct KmemCache *kmem_caches;
+
+static void check_kmem(void);
+
+static void
+slab_link(struct Slab **head, struct Slab *sl)
+{
+	sl->sl_next = *head;
+	sl->sl_pprev = head;
+	if (*head)
+		(*head)->sl_pprev = &sl->sl_next;
+	*head = sl;
+}
+
+static void
+slab_unlink(struct Slab *sl)
+{
+	*sl->sl_pprev = sl->sl_next;
+	if (sl->sl_next)
+		sl->sl_next->sl_pprev = sl->sl_pprev;
+}
+
+// How many 'size'-byte objects aligned to 'align' fit in a slab of
+// 'slabsize' bytes, after the slab header.  Stores the offset of the
+// first object in '*offset'.
+static int
+slab_fit(size_t slabsize, size_t size, size_t align, size_t *offset)
+{
+	int n;
+
+	n = (slabsize - sizeof(struct Slab)) / (size + sizeof(uint16_t));
+	for (; n > 0; n--) {
+		*offset = ROUNDUP(sizeof(struct Slab) + n * sizeof(uint16_t),
+				  align);
+		if (*offset + n * size <= slabsize)
+			break;
+	}
+	return n;
+}
+
+// Lay out the slabs of a cache of 'size'-byte objects.  Slabs grow
+// from one page until KMEM_MIN_OBJS objects fit, and the space left
+// over is used for colouring.
+static int
+cache_setup(struct KmemCache *kc, const char *name, size_t size,
+	    size_t align, void (*ctor)(void *))
+{
+	size_t left;
+
+	if (align == 0)
+		align = sizeof(void *);
+	if ((align & (align - 1)) || align > PGSIZE || size == 0)
+		return -E_INVAL;
+
+	memset(kc, 0, sizeof(*kc));
+	strncpy(kc->kc_name, name, KMEM_NAMELEN - 1);
+	kc->kc_size = ROUNDUP(size, align);
+	kc->kc_align = align;
+	kc->kc_ctor = ctor;
+	for (kc->kc_order = 0; ; kc->kc_order++) {
+		kc->kc_nobjs = slab_fit(PGSIZE << kc->kc_order, kc->kc_size,
+					align, &kc->kc_offset);
+		if (kc->kc_nobjs >= KMEM_MIN_OBJS
+		    || kc->kc_order == KMEM_MAX_ORDER)
+			break;
+	}
+	if (kc->kc_nobjs == 0)
+		return -E_INVAL;
+
+	left = (PGSIZE << kc->kc_order) - kc->kc_offset
+		- kc->kc_nobjs * kc->kc_size;
+	kc->kc_colour_step = MAX(align, KMEM_COLOUR);
+	kc->kc_ncolours = left / kc->kc_colour_step + 1;
+	return 0;
+}
+
+// Add a new slab to 'kc', with every object constructed and free.
+static struct Slab *
+cache_grow(struct KmemCache *kc)
+{
+	struct PageInfo *pp;
+	struct Slab *sl;
+	int i;
+
+	if (!(pp = page_alloc_order(kc->kc_order, 0)))
+		return NULL;
+	sl = page2kva(pp);
+	sl->sl_objs = (char *) sl + kc->kc_offset
+		+ kc->kc_colour * kc->kc_colour_step;
+	kc->kc_colour = (kc->kc_colour + 1) % kc->kc_ncolours;
+	sl->sl_inuse = 0;
+	sl->sl_nfree = kc->kc_nobjs;
+	for (i = 0; i < kc->kc_nobjs; i++) {
+		// hand the objects out in address order
+		sl->sl_free[i] = kc->kc_nobjs - 1 - i;
+		if (kc->kc_ctor)
+			kc->kc_ctor(sl->sl_objs + i * kc->kc_size);
+	}
+	kc->kc_nslabs++;
+	kc->kc_grows++;
+	return sl;
+}
+
+// Give an empty slab's pages back.
+static void
+cache_reap(struct KmemCache *kc, struct Slab *sl)
+{
+	page_free_order(pa2page(PADDR(sl)), kc->kc_order);
+	kc->kc_nslabs--;
+	kc->kc_reaps++;
+}
+
+// The slab holding 'obj', or NULL if 'obj' is not an object of 'kc'.
+static struct Slab *
+obj_slab(struct KmemCache *kc, void *obj)
+{
+	struct Slab *sl;
+	size_t off;
+
+	if ((uintptr_t) obj < KERNBASE)
+		return NULL;
+	sl = (struct Slab *) ROUNDDOWN((uintptr_t) obj, PGSIZE << kc->kc_order);
+	if ((char *) obj < sl->sl_objs)
+		return NULL;
+	off = (char *) obj - sl->sl_objs;
+	if (off % kc->kc_size || off / kc->kc_size >= kc->kc_nobjs)
+		return NULL;
+	return sl;
+}
+
+// Take one object from the slabs, growing the cache if none is free.
+static void *
+slab_alloc(struct KmemCache *kc)
+{
+	struct Slab *sl;
+
+	if (!(sl = kc->kc_partial)) {
+		if ((sl = kc->kc_empty))
+			slab_unlink(sl);
+		else if (!(sl = cache_grow(kc)))
+			return NULL;
+		slab_link(&kc->kc_partial, sl);
+	}
+	sl->sl_inuse++;
+	if (--sl->sl_nfree == 0) {
+		slab_unlink(sl);
+		slab_link(&kc->kc_full, sl);
+	}
+	kc->kc_inuse++;
+	return sl->sl_objs + sl->sl_free[sl->sl_nfree] * kc->kc_size;
+}
+
+// Put an object back in its slab.  One empty slab is kept to absorb
+// alloc/free churn; any other is given back.
+static void
+slab_free(struct KmemCache *kc, void *obj)
+{
+	struct Slab *sl = obj_slab(kc, obj);
+
+	if (sl->sl_nfree == 0) {
+		slab_unlink(sl);
+		slab_link(&kc->kc_partial, sl);
+	}
+	sl->sl_free[sl->sl_nfree++] = ((char *) obj - sl->sl_objs) / kc->kc_size;
+	kc->kc_inuse--;
+	if (--sl->sl_inuse == 0) {
+		slab_unlink(sl);
+		if (kc->kc_empty)
+			cache_reap(kc, sl);
+		else
+			slab_link(&kc->kc_empty, sl);
+	}
+}
+
+// Return the 'n' least recently freed objects of a hot cache to their
+// slabs.
+static void
+cpu_flush(struct KmemCache *kc, struct KmemCpu *kcc, int n)
+{
+	int i;
+
+	n = MIN(n, kcc->kcc_count);
+	for (i = 0; i < n; i++)
+		slab_free(kc, kcc->kcc_objs[i]);
+	kcc->kcc_count -= n;
+	memmove(kcc->kcc_objs, kcc->kcc_objs + n,
+		kcc->kcc_count * sizeof(kcc->kcc_objs[0]));
+}
+
+void
+kmem_init(void)
+{
+	int r;
+
+	r = cache_setup(&kmem_cache_cache, "kmem_cache",
+			sizeof(struct KmemCache), 0, NULL);
+	assert(r == 0);
+	kmem_caches = &kmem_cache_cache;
+
+	check_kmem();
+}
+
+struct KmemCache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+		  void (*ctor)(void *))
+{
+	struct KmemCache *kc;
+
+	if (!(kc = kmem_cache_alloc(&kmem_cache_cache)))
+		return NULL;
+	if (cache_setup(kc, name, size, align, ctor) < 0) {
+		kmem_cache_free(&kmem_cache_cache, kc);
+		return NULL;
+	}
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct KmemCache *kc)
+{
+	struct KmemCache **kcp;
+	struct Slab *sl;
+	int i;
+
+	// Its slabs hold every other cache's descriptor
+	if (kc == &kmem_cache_cache)
+		panic("kmem_cache_destroy: cannot destroy %s", kc->kc_name);
+	for (i = 0; i < NCPU; i++)
+		cpu_flush(kc, &kc->kc_cpu[i], KMEM_CPU_SIZE);
+	if (kc->kc_inuse)
+		panic("kmem_cache_destroy: %s has %u objects in use",
+		      kc->kc_name, kc->kc_inuse);
+	if ((sl = kc->kc_empty)) {
+		slab_unlink(sl);
+		cache_reap(kc, sl);
+	}
+
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next)
+		/* do nothing */;
+	*kcp = kc->kc_next;
+	kmem_cache_free(&kmem_cache_cache, kc);
+}
+
+void *
+kmem_cache_alloc(struct KmemCache *kc)
+{
+	struct KmemCpu *kcc = &kc->kc_cpu[cpunum()];
+	void *obj;
+
+	kc->kc_allocs++;
+	if (kcc->kcc_count > 0)
+		kc->kc_hits++;
+	else
+		while (kcc->kcc_count < KMEM_CPU_BATCH
+		       && (obj = slab_alloc(kc)))
+			kcc->kcc_objs[kcc->kcc_count++] = obj;
+	if (kcc->kcc_count == 0)
+		return NULL;
+	return kcc->kcc_objs[--kcc->kcc_count];
+}
+
+void
+kmem_cache_free(struct KmemCache *kc, void *obj)
+{
+	struct KmemCpu *kcc = &kc->kc_cpu[cpunum()];
+
+	if (!obj_slab(kc, obj))
+		panic("kmem_cache_free: %p is not a %s object", obj,
+		      kc->kc_name);
+	if (kcc->kcc_count == KMEM_CPU_SIZE)
+		cpu_flush(kc, kcc, KMEM_CPU_BATCH);
+	kcc->kcc_objs[kcc->kcc_count++] = obj;
+}
+
+void
+kmem_slabinfo(void)
+{
+	struct KmemCache *kc;
+	uint32_t active;
+	int i;
+
+	cprintf("cache             size  active  total  slabs  pages  "
+		"colours  allocs    hits\n");
+	for (kc = kmem_caches; kc; kc = kc->kc_next) {
+		active = kc->kc_inuse;
+		for (i = 0; i < NCPU; i++)
+			active -= kc->kc_cpu[i].kcc_count;
+		cprintf("%-16s %5u %7u %6u %6u %6u %8d %7u %7u\n",
+			kc->kc_name, kc->kc_size, active,
+			kc->kc_nslabs * kc->kc_nobjs, kc->kc_nslabs,
+			1 << kc->kc_order, kc->kc_ncolours, kc->kc_allocs,
+			kc->kc_hits);
+	}
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+#define CHECK_MAGIC	0x6b6d656d
+#define CHECK_NOBJS	64
+
+static int check_nctor;
+
+static void
+check_ctor(void *obj)
+{
+	*(uint32_t *) obj = CHECK_MAGIC;
+	check_nctor++;
+}
+
+static void
+check_kmem(void)
+{
+	struct KmemCache *kc;
+	void *objs[CHECK_NOBJS];
+	size_t off, first_off;
+	bool coloured = 0;
+	int i, j;
+
+	// 300-byte objects round up to 304: 13 fit in a page after the
+	// 48-byte header, leaving 96 bytes, room for 2 colours
+	assert((kc = kmem_cache_create("check", 300, 16, check_ctor)));
+	assert(kc->kc_order == 0 && kc->kc_nobjs == 13
+	       && kc->kc_ncolours == 2);
+
+	first_off = 0;
+	for (i = 0; i < CHECK_NOBJS; i++) {
+		assert((objs[i] = kmem_cache_alloc(kc)));
+		assert((uintptr_t) objs[i] % 16 == 0);
+		assert(*(uint32_t *) objs[i] == CHECK_MAGIC);
+		for (j = 0; j < i; j++)
+			assert(objs[j] != objs[i]);
+
+		// slabs should not all start their objects at one offset
+		off = ((uintptr_t) objs[i] % PGSIZE) % kc->kc_size;
+		if (i == 0)
+			first_off = off;
+		else if (off != first_off)
+			coloured = 1;
+	}
+	assert(coloured);
+	assert(kc->kc_nslabs >= CHECK_NOBJS / kc->kc_nobjs);
+	assert(check_nctor == kc->kc_grows * kc->kc_nobjs);
+
+	// a freed object comes straight back from the hot cache, still
+	// constructed
+	kmem_cache_free(kc, objs[0]);
+	j = kc->kc_hits;
+	assert(kmem_cache_alloc(kc) == objs[0]);
+	assert(kc->kc_hits == j + 1);
+	assert(*(uint32_t *) objs[0] == CHECK_MAGIC);
+
+	// freeing everything leaves one empty slab
+	for (i = 0; i < CHECK_NOBJS; i++)
+		kmem_cache_free(kc, objs[i]);
+	cpu_flush(kc, &kc->kc_cpu[cpunum()], KMEM_CPU_SIZE);
+	assert(kc->kc_inuse == 0);
+	assert(kc->kc_nslabs == 1 && kc->kc_empty && !kc->kc_partial
+	       && !kc->kc_full);
+	kmem_cache_destroy(kc);
+	assert(kmem_caches == &kmem_cache_cache);
+
+	// objects too big for the biggest slab
+	assert(!kmem_cache_create("check", PGSIZE << KMEM_MAX_ORDER, 0, NULL));
+	assert(!kmem_cache_create("check", 8, 3, NULL));
+
+	cprintf("check_kmem() succeeded!\n");
+}
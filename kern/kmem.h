@@ -0,0 +1,38 @@
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Slab allocator for fixed-size kernel objects.  Each cache hands out
+// objects of one size, carved from slabs of 2^order pages.
+
+#define KMEM_NAMELEN	16	// longest cache name shown by slabinfo
+#define KMEM_CPU_SIZE	16	// objects in each per-CPU hot cache
+#define KMEM_CPU_BATCH	8	// objects moved per refill or flush
+
+struct KmemCache;
+
+void	kmem_init(void);
+
+// Create a cache of 'size'-byte objects aligned to 'align' (a power
+// of two, or 0 for word alignment).  'ctor', if not NULL, is run on
+// each object once, when its slab is created; objects must be freed
+// back in their constructed state.  Returns NULL if the objects are
+// too big or there is no memory.
+struct KmemCache *kmem_cache_create(const char *name, size_t size,
+				    size_t align, void (*ctor)(void *));
+// Free every slab of 'kc' and 'kc' itself.  Panics if any of its
+// objects are still allocated, or if 'kc' is the cache that holds the
+// cache descriptors.
+void	kmem_cache_destroy(struct KmemCache *kc);
+
+// Allocate an object, or return NULL if out of memory.
+void	*kmem_cache_alloc(struct KmemCache *kc);
+void	kmem_cache_free(struct KmemCache *kc, void *obj);
+
+void	kmem_slabinfo(void);
+
+#endif	// !JOS_KERN_KMEM_H
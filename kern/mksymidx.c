@@ -0,0 +1,453 @@
+/*
+ * mksymidx: build the kernel's .symidx section from its STABS.
+ *
+ * Usage: mksymidx kernel > symidx.S
+ *
+ * Reads the .stab and .stabstr sections of a linked kernel and writes
+ * an assembly file defining a .symidx section in the format described
+ * in <inc/symidx.h>.  The kernel is then relinked with that file, and
+ * the raw stabs are left out of the loaded image.
+ * This runs on the build host, not in JOS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <inc/elf.h>
+#include <inc/symidx.h>
+
+// A STABS entry as laid out in a 32-bit image.  This mirrors struct Stab
+// in <inc/stab.h>, which can't be used on a 64-bit host.
+struct stab32 {
+	uint32_t n_strx;
+	uint8_t n_type;
+	uint8_t n_other;
+	uint16_t n_desc;
+	uint32_t n_value;
+};
+
+// The stab types we care about; see <inc/stab.h>.
+#define N_FUN		0x24
+#define N_SLINE		0x44
+#define N_SO		0x64
+#define N_SOL		0x84
+#define N_PSYM		0xa0
+
+struct fun {
+	uint32_t addr;
+	uint32_t name;			// .stabstr offset
+	uint16_t file;
+	uint16_t narg;
+	int seq;			// stab order, to keep sorting stable
+};
+
+struct line {
+	uint32_t addr;
+	uint16_t line;
+	uint16_t file;
+	int seq;
+};
+
+static const struct stab32 *stabs;
+static int nstabs;
+static const char *stabstr;
+static uint32_t stabstrsz;
+
+static struct fun *funs;
+static int nfun, maxfun;
+static struct line *lines;
+static int nline, maxline;
+static uint32_t *files;
+static int nfile, maxfile;
+
+// Output line programs and string table
+static uint8_t *prog;
+static int progsz, maxprog;
+static char *strtab;
+static int strsz, maxstr;
+
+static void
+die(const char *msg)
+{
+	fprintf(stderr, "mksymidx: %s\n", msg);
+	exit(1);
+}
+
+static void *
+grow(void *p, int *max, size_t size)
+{
+	*max = *max ? *max * 2 : 256;
+	if ((p = realloc(p, *max * size)) == NULL)
+		die("out of memory");
+	return p;
+}
+
+static const char *
+str(uint32_t strx)
+{
+	return strx < stabstrsz ? stabstr + strx : "";
+}
+
+static void
+add_fun(uint32_t addr, uint32_t name, uint16_t file)
+{
+	if (nfun == maxfun)
+		funs = grow(funs, &maxfun, sizeof(*funs));
+	funs[nfun].addr = addr;
+	funs[nfun].name = name;
+	funs[nfun].file = file;
+	funs[nfun].narg = 0;
+	funs[nfun].seq = nfun;
+	nfun++;
+}
+
+static void
+add_line(uint32_t addr, uint16_t lineno, uint16_t file)
+{
+	if (nline == maxline)
+		lines = grow(lines, &maxline, sizeof(*lines));
+	lines[nline].addr = addr;
+	lines[nline].line = lineno;
+	lines[nline].file = file;
+	lines[nline].seq = nline;
+	nline++;
+}
+
+static uint16_t
+intern_file(uint32_t strx)
+{
+	int i;
+
+	for (i = 0; i < nfile; i++)
+		if (files[i] == strx)
+			return i;
+	if (nfile == SYMIDX_NOFILE)
+		die("too many source files");
+	if (nfile == maxfile)
+		files = grow(files, &maxfile, sizeof(*files));
+	files[nfile] = strx;
+	return nfile++;
+}
+
+// Directory N_SO/N_SOL entries end in '/' and name no code.
+static int
+is_dir(uint32_t strx)
+{
+	const char *s = str(strx);
+	size_t n = strlen(s);
+
+	return n > 0 && s[n - 1] == '/';
+}
+
+static void
+read_kernel(const char *path)
+{
+	FILE *f;
+	long size;
+	char *img, *shstr;
+	struct Elf *elf;
+	struct Secthdr *sh;
+	uint32_t shstrsz;
+	int i;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	if ((img = malloc(size)) == NULL)
+		die("out of memory");
+	if (fread(img, 1, size, f) != size)
+		die("short read");
+	fclose(f);
+
+	elf = (struct Elf *) img;
+	if (size < sizeof(*elf) || elf->e_magic != ELF_MAGIC)
+		die("not an ELF file");
+	if (elf->e_shoff + elf->e_shnum * sizeof(*sh) > size
+	    || elf->e_shstrndx >= elf->e_shnum)
+		die("bad section headers");
+	sh = (struct Secthdr *) (img + elf->e_shoff);
+
+	// .bss and friends take no space in the file, so only sections
+	// with contents have to fit in it.
+	for (i = 0; i < elf->e_shnum; i++)
+		if (sh[i].sh_type != ELF_SHT_NOBITS
+		    && (sh[i].sh_offset > size
+			|| sh[i].sh_size > size - sh[i].sh_offset))
+			die("section extends past end of file");
+	if (sh[elf->e_shstrndx].sh_type == ELF_SHT_NOBITS)
+		die("bad section name table");
+	shstr = img + sh[elf->e_shstrndx].sh_offset;
+	shstrsz = sh[elf->e_shstrndx].sh_size;
+
+	for (i = 0; i < elf->e_shnum; i++) {
+		if (sh[i].sh_name >= shstrsz
+		    || memchr(shstr + sh[i].sh_name, 0,
+			      shstrsz - sh[i].sh_name) == NULL)
+			die("bad section name");
+		if (strcmp(shstr + sh[i].sh_name, ".stab") == 0) {
+			stabs = (struct stab32 *) (img + sh[i].sh_offset);
+			nstabs = sh[i].sh_size / sizeof(*stabs);
+		} else if (strcmp(shstr + sh[i].sh_name, ".stabstr") == 0) {
+			stabstr = img + sh[i].sh_offset;
+			stabstrsz = sh[i].sh_size;
+		}
+	}
+}
+
+// Walk the stabs in order, turning N_SO and N_FUN entries into address
+// ranges and N_SLINE entries into absolute line table entries.
+static void
+scan_stabs(void)
+{
+	const struct stab32 *s;
+	uint32_t fun_addr = 0;
+	uint16_t file = SYMIDX_NOFILE, line_file = SYMIDX_NOFILE;
+	int i, in_fun = 0, in_args = 0;
+	const char *colon;
+
+	for (i = 0; i < nstabs; i++) {
+		s = &stabs[i];
+		if (s->n_type != N_PSYM)
+			in_args = 0;
+
+		switch (s->n_type) {
+		case N_SO:
+			in_fun = 0;
+			if (str(s->n_strx)[0] == 0) {
+				// End of a source file's text
+				add_fun(s->n_value, 0, SYMIDX_NOFILE);
+				file = line_file = SYMIDX_NOFILE;
+			} else if (!is_dir(s->n_strx)) {
+				file = line_file = intern_file(s->n_strx);
+				add_fun(s->n_value, 0, file);
+			}
+			break;
+
+		case N_SOL:
+			if (!is_dir(s->n_strx))
+				line_file = intern_file(s->n_strx);
+			break;
+
+		case N_FUN:
+			if (str(s->n_strx)[0] == 0) {
+				// End of function; n_value is its size
+				if (in_fun)
+					add_fun(fun_addr + s->n_value, 0, file);
+				in_fun = 0;
+				break;
+			}
+			// Only 'F' (global) and 'f' (static) name functions
+			colon = strchr(str(s->n_strx), ':');
+			if (!colon || (colon[1] != 'F' && colon[1] != 'f'))
+				break;
+			fun_addr = s->n_value;
+			in_fun = in_args = 1;
+			add_fun(fun_addr, s->n_strx, file);
+			break;
+
+		case N_PSYM:
+			if (in_args)
+				funs[nfun - 1].narg++;
+			break;
+
+		case N_SLINE:
+			// Line addresses are relative to the enclosing function
+			add_line(in_fun ? fun_addr + s->n_value : s->n_value,
+				 s->n_desc, line_file);
+			break;
+		}
+	}
+}
+
+static int
+fun_cmp(const void *a, const void *b)
+{
+	const struct fun *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->seq - y->seq;
+}
+
+static int
+line_cmp(const void *a, const void *b)
+{
+	const struct line *x = a, *y = b;
+
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return x->seq - y->seq;
+}
+
+// Sort both tables by address.  Where several entries share an address,
+// keep the last one in stab order: it is the innermost range (a function
+// rather than its file) or the line that debuginfo_eip used to pick.
+static void
+sort_tables(void)
+{
+	int i, n;
+
+	qsort(funs, nfun, sizeof(*funs), fun_cmp);
+	for (i = n = 0; i < nfun; i++) {
+		if (n > 0 && funs[n - 1].addr == funs[i].addr)
+			n--;
+		funs[n++] = funs[i];
+	}
+	nfun = n;
+
+	qsort(lines, nline, sizeof(*lines), line_cmp);
+	for (i = n = 0; i < nline; i++) {
+		if (n > 0 && lines[n - 1].addr == lines[i].addr)
+			n--;
+		lines[n++] = lines[i];
+	}
+	nline = n;
+}
+
+// Add a name to the output string table, up to any ':' type suffix,
+// and return its offset.  Offset 0 is always the empty string.
+static uint32_t
+add_str(uint32_t strx)
+{
+	const char *s = str(strx);
+	size_t n = strcspn(s, ":");
+	int i;
+
+	if (strsz == 0) {
+		strtab = grow(strtab, &maxstr, 1);
+		strtab[strsz++] = 0;
+	}
+	if (n == 0)
+		return 0;
+	for (i = 1; i < strsz; i += strlen(strtab + i) + 1)
+		if (strlen(strtab + i) == n && memcmp(strtab + i, s, n) == 0)
+			return i;
+	while (strsz + n + 1 > maxstr)
+		strtab = grow(strtab, &maxstr, 1);
+	memcpy(strtab + strsz, s, n);
+	strtab[strsz + n] = 0;
+	strsz += n + 1;
+	return i;
+}
+
+static void
+add_byte(uint8_t b)
+{
+	if (progsz == maxprog)
+		prog = grow(prog, &maxprog, 1);
+	prog[progsz++] = b;
+}
+
+static void
+add_uleb(uint32_t v)
+{
+	while (v >= 0x80) {
+		add_byte(v | 0x80);
+		v >>= 7;
+	}
+	add_byte(v);
+}
+
+static void
+add_sleb(int32_t v)
+{
+	while (v < -0x40 || v >= 0x40) {
+		add_byte(v | 0x80);
+		v >>= 7;
+	}
+	add_byte(v & 0x7f);
+}
+
+// Encode each range's lines as a delta program, replacing the ranges'
+// .stabstr name offsets with output string table offsets as we go.
+// Lines outside every source file are dropped.
+static uint32_t *
+encode_lines(void)
+{
+	uint32_t *offsets, addr;
+	int i, j, lineno;
+	uint16_t file;
+
+	if ((offsets = malloc((nfun + 1) * sizeof(*offsets))) == NULL)
+		die("out of memory");
+	for (i = j = 0; i < nfun; i++) {
+		funs[i].name = add_str(funs[i].name);
+		offsets[i] = progsz;
+		addr = funs[i].addr;
+		lineno = 0;
+		file = funs[i].file;
+		while (j < nline && lines[j].addr < funs[i].addr)
+			j++;
+		for (; j < nline && (i + 1 == nfun || lines[j].addr < funs[i + 1].addr); j++) {
+			if (funs[i].file == SYMIDX_NOFILE)
+				continue;
+			add_uleb((lines[j].addr - addr) << 1 | (lines[j].file != file));
+			if (lines[j].file != file)
+				add_uleb(lines[j].file);
+			add_sleb(lines[j].line - lineno);
+			addr = lines[j].addr;
+			lineno = lines[j].line;
+			file = lines[j].file;
+		}
+	}
+	return offsets;
+}
+
+static void
+emit_bytes(const void *p, int n)
+{
+	const uint8_t *b = p;
+	int i;
+
+	for (i = 0; i < n; i++)
+		printf("%s0x%02x%s", i % 16 ? ", " : "\t.byte\t", b[i],
+		       i % 16 == 15 || i == n - 1 ? "\n" : "");
+}
+
+static void
+emit(const char *kernel)
+{
+	uint32_t *offsets;
+	int i;
+
+	offsets = encode_lines();
+	for (i = 0; i < nfile; i++)
+		files[i] = add_str(files[i]);
+
+	printf("# Generated by mksymidx from %s.  DO NOT EDIT.\n\n", kernel);
+	printf(".section .symidx, \"a\"\n");
+	printf(".p2align 2\n");
+	printf("\t.long\t0x%08x, %d, %d, %d, %d\n",
+	       SYMIDX_MAGIC, nfun, nfile, progsz, strsz);
+	for (i = 0; i < nfun; i++)
+		printf("\t.long\t0x%08x\n", funs[i].addr);
+	for (i = 0; i < nfun; i++)
+		printf("\t.long\t%u, %u\n\t.short\t%u, %u\n",
+		       offsets[i], funs[i].name, funs[i].file, funs[i].narg);
+	for (i = 0; i < nfile; i++)
+		printf("\t.long\t%u\n", files[i]);
+	emit_bytes(prog, progsz);
+	emit_bytes(strtab, strsz);
+	free(offsets);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: mksymidx kernel > symidx.S\n");
+		exit(2);
+	}
+
+	read_kernel(argv[1]);
+	scan_stabs();
+	sort_tables();
+	emit(argv[1]);
+	return 0;
+}
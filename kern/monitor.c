@@ -10,8 +10,16 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/profile.h>
+#include <kern/fprof.h>
+#include <kern/trace.h>
+#include <kern/probe.h>
+#include <kern/bench.h>
+#include <kern/pmap.h>
+#include <kern/kmem.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
+#define BACKTRACE_DEPTH	32	// most frames mon_backtrace will print
 
 
 struct Command {
@@ -24,6 +32,13 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "profile", "Sample the kernel: profile start [hz] [depth]|stop|report [n]|folded", mon_profile },
+	{ "fprof", "Show per-function cycle counts (make KPROF=1): fprof [n]|reset", mon_fprof },
+	{ "trace", "Static tracepoints: trace list|on <name>|off <name>|dump [n]|clear", mon_trace },
+	{ "probe", "Time calls to a function: probe add <fn>|del <fn>|stats", mon_probe },
+	{ "bench", "Run the kernel microbenchmarks", mon_bench },
+	{ "meminfo", "Show free physical memory by block size", mon_meminfo },
+	{ "slabinfo", "Show the kernel object caches", mon_slabinfo },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -57,34 +72,111 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
-	uint32_t ebp;
-    	int i;
-	struct Eipdebuginfo info; 
-
-    	cprintf("Stack backtrace:\n");
+	uint32_t pcs[BACKTRACE_DEPTH], ebp, *frame;
+	struct Eipdebuginfo info;
+	int i, j, n;
+
+	cprintf("Stack backtrace:\n");
+
+	// Capture the raw return addresses first, then symbolise them.
+	ebp = read_ebp();
+	n = stack_capture(pcs, ARRAY_SIZE(pcs), ebp);
+
+	for (i = 0; i < n; i++) {
+		frame = (uint32_t *) ebp;
+		cprintf("  ebp %08x  eip %08x  args", ebp, pcs[i]);
+		for (j = 0; j < 5; j++)
+			cprintf(" %08x", frame[2 + j]);
+		if (debuginfo_eip(pcs[i], &info) < 0) {
+			cprintf("debuginfo_eip error");
+			return -1;
+		}
+		cprintf("\n       %s:%d: %.*s+%d\n", info.eip_file, info.eip_line,
+			info.eip_fn_namelen, info.eip_fn_name,
+			pcs[i] - info.eip_fn_addr);
+		ebp = frame[0];
+	}
+	return 0;
+}
 
-    	ebp = read_ebp();
+int
+mon_profile(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+		profile_start(argc >= 3 ? strtol(argv[2], 0, 0) : PROF_DEFHZ,
+			      argc >= 4 ? strtol(argv[3], 0, 0) : 1);
+	} else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+		profile_stop();
+	} else if (argc >= 2 && strcmp(argv[1], "report") == 0) {
+		profile_report(argc >= 3 ? strtol(argv[2], 0, 0) : 20);
+	} else if (argc == 2 && strcmp(argv[1], "folded") == 0) {
+		profile_folded();
+	} else {
+		cprintf("Usage: profile start [hz] [depth]|stop|report [n]|folded\n");
+	}
+	return 0;
+}
 
-    	while (ebp != 0) {
-        	cprintf("  ebp %08x", ebp);
+int
+mon_fprof(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "reset") == 0)
+		fprof_reset();
+	else
+		fprof_report(argc >= 2 ? strtol(argv[1], 0, 0) : 20);
+	return 0;
+}
 
-        	cprintf("  eip %08x", *(uint32_t *)(ebp+4));
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "list") == 0)
+		trace_list();
+	else if (argc == 3 && (strcmp(argv[1], "on") == 0
+			       || strcmp(argv[1], "off") == 0)) {
+		if (trace_enable(argv[2], argv[1][1] == 'n') == 0)
+			cprintf("No tracepoint '%s'\n", argv[2]);
+	} else if (argc >= 2 && strcmp(argv[1], "dump") == 0)
+		trace_dump(argc >= 3 ? strtol(argv[2], 0, 0) : 20);
+	else if (argc == 2 && strcmp(argv[1], "clear") == 0)
+		trace_clear();
+	else
+		cprintf("Usage: trace list|on <name>|off <name>|dump [n]|clear\n");
+	return 0;
+}
 
-        	cprintf("  args");
+int
+mon_probe(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 3 && strcmp(argv[1], "add") == 0)
+		probe_add(argv[2]);
+	else if (argc == 3 && strcmp(argv[1], "del") == 0)
+		probe_del(argv[2]);
+	else if (argc == 2 && strcmp(argv[1], "stats") == 0)
+		probe_stats();
+	else
+		cprintf("Usage: probe add <fn>|del <fn>|stats\n");
+	return 0;
+}
 
-       		for (i=0; i<5; i++) {
-           	 cprintf(" %08x", *(uint32_t *)(ebp+8+i*4));
-        	}
-	 	if (debuginfo_eip(*(uint32_t *)(ebp+4), &info) < 0) {
-            		cprintf("debuginfo_eip error");
- 	           	return -1;
-        	}	
+int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	bench_run();
+	return 0;
+}
 
-		cprintf("\n       %s:%d: %.*s+%d", info.eip_file, info.eip_line, info.eip_fn_namelen, info.eip_fn_name, *(uint32_t *)(ebp+4) - info.eip_fn_addr);
+int
+mon_meminfo(int argc, char **argv, struct Trapframe *tf)
+{
+	page_stats();
+	return 0;
+}
 
-       		ebp = *(uint32_t *)ebp;
-        	cprintf("\n");
-    	}
+int
+mon_slabinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	kmem_slabinfo();
 	return 0;
 }
 
@@ -0,0 +1,1109 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/multiboot.h>
+
+#include <kern/pmap.h>
+#include <kern/kclock.h>
+#include <kern/trace.h>
+#include <kern/cpu.h>
+
+// The most physical memory the kernel can use: all of it must be
+// mapped at KERNBASE.
+#define PHYSMEM_MAX	((uint32_t) -KERNBASE)
+
+// CPUID.1:EDX bit for 4MB pages
+#define CPUID_PSE	0x00000008
+// CPUID.1:EDX bit for SSE2, which has the non-temporal movnti
+#define CPUID_SSE2	0x04000000
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+
+// The physical memory map, in page-aligned ranges.  A page is usable
+// if it lies in a usable range and overlaps no reserved one.
+#define NMEMRANGES	64
+static struct MemRange {
+	physaddr_t mr_start;
+	physaddr_t mr_end;		// exclusive
+	bool mr_usable;
+} mem_ranges[NMEMRANGES];
+static int nmem_ranges;
+
+// These variables are set in mem_init()
+pde_t *kern_pgdir;		// Kernel's initial page directory
+struct PageInfo *pages;		// Physical page state array
+static bool pse_enabled;	// 4MB pages are on
+static bool sse2_present;	// movnti is available
+
+// The buddy allocator's free blocks, one list per order.  A block of
+// order n is 2^n pages, aligned to its size, and is listed by its first
+// page.
+static struct FreeArea {
+	struct PageInfo *fa_list;
+	size_t fa_nfree;		// number of blocks on fa_list
+} free_area[PAGE_MAX_ORDER + 1];
+
+// Each CPU keeps a magazine of free single pages in front of the free
+// lists, so that most page_alloc() and page_free() calls are a pop or
+// a push on a CPU-local array.  Magazines move pages to and from the
+// free lists PAGE_MAG_BATCH at a time.
+#define PAGE_MAG_SIZE	32
+#define PAGE_MAG_BATCH	16
+static struct PageMag {
+	int pm_count;
+	struct PageInfo *pm_pages[PAGE_MAG_SIZE];
+} page_mags[NCPU];
+
+// Free pages zeroed ahead of time by page_zero_idle(), which
+// page_alloc(ALLOC_ZERO) hands out before any others.
+#define PAGE_ZPOOL_SIZE	64
+static struct {
+	int zp_count;
+	struct PageInfo *zp_pages[PAGE_ZPOOL_SIZE];
+} zpool;
+
+// Values of pp_free
+#define PP_BUDDY	1	// first page of a block on a free list
+#define PP_MAGAZINE	2	// in a CPU's magazine
+#define PP_ZEROED	3	// in the zero pool
+
+// Allocator statistics, shown by page_stats()
+static struct {
+	uint32_t allocs[PAGE_MAX_ORDER + 1];
+	uint32_t frees[PAGE_MAX_ORDER + 1];
+	uint32_t fails;			// allocations with no block to give
+	uint32_t splits;
+	uint32_t merges;
+} buddy_stats;
+
+static struct {
+	uint32_t hits;			// allocations served by the magazine
+	uint32_t refills;
+	uint32_t drains;
+} mag_stats[NCPU];
+
+static struct {
+	uint32_t hits;			// ALLOC_ZERO served by the pool
+	uint32_t misses;		// ALLOC_ZERO cleared on the spot
+	uint32_t zeroed;		// pages zeroed in idle time
+} zpool_stats;
+
+// Global descriptor table.  The kernel loads its own in mem_init(),
+// because the boot loader's lies in low memory that kern_pgdir does
+// not map.
+struct Segdesc gdt[] =
+{
+	// 0x0 - unused (always faults -- for trapping NULL far pointers)
+	SEG_NULL,
+
+	// 0x8 - kernel code segment
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+
+	// 0x10 - kernel data segment
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+
+	// 0x18 - user code segment
+	[GD_UT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 3),
+
+	// 0x20 - user data segment
+	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
+
+	// 0x28 - tss, initialized once there is a TSS
+	[GD_TSS0 >> 3] = SEG_NULL
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (unsigned long) gdt
+};
+
+static void check_page_free_list(void);
+static void check_page_alloc(void);
+static void check_kern_pgdir(void);
+static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+// Record the physical range [addr, addr+len).  Usable ranges shrink to
+// whole pages and reserved ones grow to them, and everything above
+// PHYSMEM_MAX is dropped.
+static void
+mem_add_range(uint64_t addr, uint64_t len, bool usable)
+{
+	uint64_t end = addr + len;
+	physaddr_t start, stop;
+
+	if (len == 0 || addr >= PHYSMEM_MAX)
+		return;
+	end = MIN(end, (uint64_t) PHYSMEM_MAX);
+	if (usable) {
+		start = ROUNDUP((physaddr_t) addr, PGSIZE);
+		stop = ROUNDDOWN((physaddr_t) end, PGSIZE);
+	} else {
+		start = ROUNDDOWN((physaddr_t) addr, PGSIZE);
+		stop = ROUNDUP((physaddr_t) end, PGSIZE);
+	}
+	if (start >= stop)
+		return;
+	if (nmem_ranges == NMEMRANGES) {
+		cprintf("memory map: too many ranges, ignoring %08x-%08x\n",
+			start, stop);
+		return;
+	}
+	mem_ranges[nmem_ranges].mr_start = start;
+	mem_ranges[nmem_ranges].mr_end = stop;
+	mem_ranges[nmem_ranges].mr_usable = usable;
+	nmem_ranges++;
+}
+
+// Is the page at 'pa' usable RAM?
+static bool
+mem_usable(physaddr_t pa)
+{
+	bool usable = 0;
+	int i;
+
+	for (i = 0; i < nmem_ranges; i++) {
+		if (pa + PGSIZE <= mem_ranges[i].mr_start
+		    || pa >= mem_ranges[i].mr_end)
+			continue;
+		if (!mem_ranges[i].mr_usable)
+			return 0;
+		usable = 1;
+	}
+	return usable;
+}
+
+// Read the memory map from a Multiboot info structure, which is either
+// one boot/boot.S built from the BIOS's E820 map or a real Multiboot
+// loader's.  Only the first 4MB of physical memory is mapped yet, so
+// anything above that is ignored.
+static void
+multiboot_detect_memory(physaddr_t mbinfo)
+{
+	struct MultibootInfo *mbi;
+	struct MultibootMmap *mm;
+	physaddr_t p, end;
+
+	if (mbinfo >= PTSIZE - sizeof(*mbi))
+		return;
+	mbi = (struct MultibootInfo *) (mbinfo + KERNBASE);
+
+	if ((mbi->mbi_flags & MULTIBOOT_INFO_MEM_MAP)
+	    && mbi->mbi_mmap_length <= PTSIZE
+	    && mbi->mbi_mmap_addr <= PTSIZE - mbi->mbi_mmap_length) {
+		p = mbi->mbi_mmap_addr;
+		end = p + mbi->mbi_mmap_length;
+		for (; p + sizeof(*mm) <= end; p += mm->mm_size + 4) {
+			mm = (struct MultibootMmap *) (p + KERNBASE);
+			mem_add_range(mm->mm_addr, mm->mm_len,
+				      mm->mm_type == MULTIBOOT_MEMORY_AVAILABLE);
+		}
+	}
+	if (nmem_ranges == 0 && (mbi->mbi_flags & MULTIBOOT_INFO_MEMORY)) {
+		mem_add_range(0, mbi->mbi_mem_lower * 1024, 1);
+		mem_add_range(EXTPHYSMEM, mbi->mbi_mem_upper * 1024, 1);
+	}
+}
+
+static void
+i386_detect_memory(uint32_t mbmagic, physaddr_t mbinfo)
+{
+	const char *source = "boot loader";
+	size_t basemem, extmem, ext16mem, navail = 0;
+	physaddr_t top = 0;
+	int i;
+
+	if (mbmagic == MULTIBOOT_BOOTLOADER_MAGIC)
+		multiboot_detect_memory(mbinfo);
+
+	for (i = 0; i < nmem_ranges; i++)
+		if (mem_ranges[i].mr_usable)
+			break;
+	if (i == nmem_ranges) {
+		// No map: use the CMOS calls to measure available base
+		// & extended memory.  (CMOS calls return results in
+		// kilobytes.)  This misses any holes, and memory above
+		// 4GB.
+		source = "NVRAM";
+		nmem_ranges = 0;
+		basemem = nvram_read(NVRAM_BASELO);
+		extmem = nvram_read(NVRAM_EXTLO);
+		ext16mem = nvram_read(NVRAM_EXT16LO) * 64;
+
+		mem_add_range(0, basemem * 1024, 1);
+		if (ext16mem)
+			mem_add_range(EXTPHYSMEM, (16 * 1024 + ext16mem) * 1024
+				      - EXTPHYSMEM, 1);
+		else
+			mem_add_range(EXTPHYSMEM, extmem * 1024, 1);
+	}
+
+	for (i = 0; i < nmem_ranges; i++)
+		if (mem_ranges[i].mr_usable)
+			top = MAX(top, mem_ranges[i].mr_end);
+	npages = top / PGSIZE;
+	for (i = 0; i < npages; i++)
+		if (mem_usable(i * PGSIZE))
+			navail++;
+
+	cprintf("Physical memory: %uK available, top = %uK (from %s)\n",
+		navail * PGSIZE / 1024, top / 1024, source);
+}
+
+
+// --------------------------------------------------------------
+// Set up memory mappings above UTOP.
+// --------------------------------------------------------------
+
+static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm);
+
+// This simple physical memory allocator is used only while JOS is setting
+// up its virtual memory system.  page_alloc() is the real allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold 'n'
+// bytes.  Doesn't initialize the memory.  Returns a kernel virtual address.
+//
+// If n==0, returns the address of the next free page without allocating
+// anything.
+//
+// If we're out of memory, boot_alloc should panic.
+// This function may ONLY be used during initialization,
+// before the free lists have been set up.
+static void *
+boot_alloc(uint32_t n)
+{
+	static char *nextfree;	// virtual address of next byte of free memory
+	char *result;
+
+	// Initialize nextfree if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment:
+	// the first virtual address that the linker did *not* assign
+	// to any kernel code or global variables.
+	if (!nextfree) {
+		extern char end[];
+		nextfree = ROUNDUP((char *) end, PGSIZE);
+	}
+
+	// Only the first 4MB is mapped until mem_init switches page
+	// tables.
+	result = nextfree;
+	nextfree = ROUNDUP(nextfree + n, PGSIZE);
+	if (PADDR(nextfree) > MIN(PTSIZE, npages * PGSIZE))
+		panic("boot_alloc: out of memory");
+	return result;
+}
+
+// Load the kernel's GDT and reload the segment registers from it.
+static void
+gdt_init(void)
+{
+	lgdt(&gdt_pd);
+	// The kernel never uses GS or FS, so we leave those set to
+	// the user data segment.
+	asm volatile("movw %%ax,%%gs" : : "a" (GD_UD|3));
+	asm volatile("movw %%ax,%%fs" : : "a" (GD_UD|3));
+	// The kernel does use ES, DS, and SS.  We'll change between
+	// the kernel and user data segments as needed.
+	asm volatile("movw %%ax,%%es" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" : : "a" (GD_KD));
+	// Load the kernel text segment into CS.
+	asm volatile("ljmp %0,$1f\n 1:\n" : : "i" (GD_KT));
+	// For good measure, clear the local descriptor table (LDT),
+	// since we don't use it.
+	lldt(0);
+}
+
+// Set up a two-level page table:
+//    kern_pgdir is its linear (virtual) address of the root
+//
+// The kernel maps all of physical memory at KERNBASE and its stack
+// below KSTACKTOP.  Nothing is mapped for user programs yet.
+//
+// 'mbmagic' and 'mbinfo' are the values the boot loader passed in
+// %eax and %ebx.
+void
+mem_init(uint32_t mbmagic, physaddr_t mbinfo)
+{
+	uint32_t cr0, edx;
+
+	// Find out how much memory the machine has (npages) and where.
+	i386_detect_memory(mbmagic, mbinfo);
+
+	// Use 4MB pages for the kernel's big mappings if the CPU has them,
+	// and non-temporal stores for zeroing pages in idle time.
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & CPUID_PSE) {
+		lcr4(rcr4() | CR4_PSE);
+		pse_enabled = 1;
+	}
+	sse2_present = (edx & CPUID_SSE2) != 0;
+
+	// create initial page directory.
+	kern_pgdir = (pde_t *) boot_alloc(PGSIZE);
+	memset(kern_pgdir, 0, PGSIZE);
+
+	// Allocate an array of npages 'struct PageInfo's and store it in
+	// 'pages'.  The kernel uses this array to keep track of physical
+	// pages: for each physical page, there is a corresponding struct
+	// PageInfo in this array.
+	pages = (struct PageInfo *) boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
+
+	// Now that we've allocated the initial kernel data structures,
+	// we set up the list of free physical pages.
+	page_init();
+
+	check_page_free_list();
+	check_page_alloc();
+	memset(&buddy_stats, 0, sizeof(buddy_stats));
+	memset(mag_stats, 0, sizeof(mag_stats));
+	memset(&zpool_stats, 0, sizeof(zpool_stats));
+
+	// Use the physical memory that 'bootstack' refers to as the
+	// kernel stack.  The guard page below it is left unmapped.
+	boot_map_region(kern_pgdir, KSTACKTOP - KSTKSIZE, KSTKSIZE,
+			PADDR(bootstack), PTE_W);
+
+	// Map all of physical memory at KERNBASE.
+	boot_map_region(kern_pgdir, KERNBASE, PHYSMEM_MAX, 0, PTE_W);
+
+	check_kern_pgdir();
+
+	// Switch from the minimal entry page directory, and from the
+	// boot loader's GDT, to the full ones.
+	gdt_init();
+	lcr3(PADDR(kern_pgdir));
+
+	// entry.S set the really important flags in cr0 (including
+	// enabling paging).  Here we configure the rest of the flags
+	// that we care about.
+	cr0 = rcr0();
+	cr0 |= CR0_PE|CR0_PG|CR0_AM|CR0_WP|CR0_NE|CR0_MP;
+	cr0 &= ~(CR0_TS|CR0_EM);
+	lcr0(cr0);
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct PageInfo' entry per physical page.
+// Pages are reference counted, and free pages are kept by a binary
+// buddy allocator: a free block of 2^n pages sits on free_area[n], and
+// when a block is freed it merges with its equal-sized neighbour (its
+// "buddy") for as long as that is free too.
+// --------------------------------------------------------------
+
+// Put the block starting at 'pp' on the free list for 'order'.
+static void
+free_area_push(struct PageInfo *pp, int order)
+{
+	struct FreeArea *fa = &free_area[order];
+
+	pp->pp_order = order;
+	pp->pp_free = PP_BUDDY;
+	pp->pp_prev = NULL;
+	pp->pp_link = fa->fa_list;
+	if (fa->fa_list)
+		fa->fa_list->pp_prev = pp;
+	fa->fa_list = pp;
+	fa->fa_nfree++;
+}
+
+// Take the free block starting at 'pp' off its free list.
+static void
+free_area_remove(struct PageInfo *pp)
+{
+	struct FreeArea *fa = &free_area[pp->pp_order];
+
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		fa->fa_list = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_link = pp->pp_prev = NULL;
+	pp->pp_free = 0;
+	fa->fa_nfree--;
+}
+
+// Take a block of 2^order pages off the free lists.  The smallest free
+// block that is big enough gets split, keeping the lower half each
+// time.  So single pages come from the small fragments of low memory
+// around the kernel first, which entry_pgdir maps and mem_init()
+// relies on before it loads kern_pgdir.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp;
+	int o;
+
+	for (o = order; o <= PAGE_MAX_ORDER && !free_area[o].fa_list; o++)
+		/* do nothing */;
+	if (o > PAGE_MAX_ORDER)
+		return NULL;
+
+	pp = free_area[o].fa_list;
+	free_area_remove(pp);
+	while (o > order) {
+		o--;
+		free_area_push(pp + (1 << o), o);
+		buddy_stats.splits++;
+	}
+	pp->pp_order = order;
+	buddy_stats.allocs[order]++;
+	return pp;
+}
+
+// Put the block of 2^order pages starting at 'pp' on the free lists,
+// merging it with its buddy for as long as that is free too.
+static void
+buddy_free(struct PageInfo *pp, int order)
+{
+	size_t i = pp - pages, buddy;
+
+	buddy_stats.frees[order]++;
+	for (; order < PAGE_MAX_ORDER; order++) {
+		buddy = i ^ (1 << order);
+		if (buddy >= npages || pages[buddy].pp_free != PP_BUDDY
+		    || pages[buddy].pp_order != order)
+			break;
+		free_area_remove(&pages[buddy]);
+		i &= ~(size_t) (1 << order);
+		buddy_stats.merges++;
+	}
+	free_area_push(&pages[i], order);
+}
+
+// Fill an empty magazine with a batch of pages from the free lists.
+static void
+mag_refill(struct PageMag *pm)
+{
+	struct PageInfo *pp;
+
+	while (pm->pm_count < PAGE_MAG_BATCH && (pp = buddy_alloc(0))) {
+		pp->pp_free = PP_MAGAZINE;
+		pm->pm_pages[pm->pm_count++] = pp;
+	}
+	mag_stats[pm - page_mags].refills++;
+}
+
+// Return the 'n' least recently freed pages of a magazine to the free
+// lists.  The most recently freed ones stay, as they are the likeliest
+// to still be in the cache.
+static void
+mag_drain(struct PageMag *pm, int n)
+{
+	int i;
+
+	n = MIN(n, pm->pm_count);
+	for (i = 0; i < n; i++) {
+		pm->pm_pages[i]->pp_free = 0;
+		buddy_free(pm->pm_pages[i], 0);
+	}
+	pm->pm_count -= n;
+	memmove(pm->pm_pages, pm->pm_pages + n,
+		pm->pm_count * sizeof(pm->pm_pages[0]));
+	mag_stats[pm - page_mags].drains++;
+}
+
+// Zero a page for the zero pool.  With SSE2, non-temporal stores keep
+// this from filling the cache with a page that may not be used for a
+// long time.
+static void
+page_zero(void *va)
+{
+	uint32_t *p, *end = (uint32_t *) va + PGSIZE / 4;
+
+	if (!sse2_present) {
+		memset(va, 0, PGSIZE);
+		return;
+	}
+	for (p = va; p < end; p += 4)
+		asm volatile("movnti %1, 0(%0)\n\t"
+			     "movnti %1, 4(%0)\n\t"
+			     "movnti %1, 8(%0)\n\t"
+			     "movnti %1, 12(%0)"
+			     : : "r" (p), "r" (0) : "memory");
+	// The stores are weakly ordered; finish them before the page can
+	// be handed out.
+	asm volatile("sfence" : : : "memory");
+}
+
+static struct PageInfo *
+zpool_pop(void)
+{
+	struct PageInfo *pp = zpool.zp_pages[--zpool.zp_count];
+
+	pp->pp_free = 0;
+	return pp;
+}
+
+// Give the pages held in this CPU's magazine and in the zero pool back
+// to the free lists, where they can merge into bigger blocks.  Returns
+// 0 if there were none.
+static bool
+page_reclaim(struct PageMag *pm)
+{
+	bool any = pm->pm_count > 0 || zpool.zp_count > 0;
+
+	if (pm->pm_count > 0)
+		mag_drain(pm, pm->pm_count);
+	while (zpool.zp_count > 0)
+		buddy_free(zpool_pop(), 0);
+	return any;
+}
+
+//
+// Initialize page structure and memory free lists.
+// After this is done, NEVER use boot_alloc again.  ONLY use the page
+// allocator functions below to allocate and deallocate physical
+// memory via the free lists.
+//
+// Free pages are those the memory map calls usable, except:
+//  - physical page 0, which holds the real-mode IDT and BIOS
+//    structures, and the memory map boot.S collected;
+//  - the kernel and everything boot_alloc() has handed out.
+// Freeing the pages in address order merges them into the largest
+// blocks that fit.  The magazines start out empty.
+//
+void
+page_init(void)
+{
+	physaddr_t pa, kern_end = PADDR(boot_alloc(0));
+	size_t i;
+
+	static_assert(PGSIZE << PAGE_MAX_ORDER == PTSIZE);
+
+	memset(free_area, 0, sizeof(free_area));
+	memset(page_mags, 0, sizeof(page_mags));
+	for (i = 0; i < npages; i++) {
+		pa = i * PGSIZE;
+		if (pa == 0 || (pa >= IOPHYSMEM && pa < kern_end)
+		    || !mem_usable(pa)) {
+			pages[i].pp_ref = 1;
+			continue;
+		}
+		pages[i].pp_ref = 0;
+		buddy_free(&pages[i], 0);
+	}
+}
+
+//
+// Allocates a block of 2^order contiguous physical pages, aligned to
+// its size, and returns its first page.  If (alloc_flags & ALLOC_ZERO),
+// fills the whole block with '\0' bytes.  Does NOT increment the
+// reference count of the page - the caller must do these if necessary
+// (either explicitly or via page_insert).
+//
+// Single pages come from page_alloc().  If no block is big enough, the
+// magazine and the zero pool are drained in case their pages complete
+// one.
+//
+// Returns NULL if there is no free block that big.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageMag *pm = &page_mags[cpunum()];
+	struct PageInfo *pp;
+
+	if (order == 0)
+		return page_alloc(alloc_flags);
+	if (order < 0 || order > PAGE_MAX_ORDER)
+		return NULL;
+
+	if (!(pp = buddy_alloc(order)) && page_reclaim(pm))
+		pp = buddy_alloc(order);
+	if (!pp) {
+		buddy_stats.fails++;
+		return NULL;
+	}
+
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, PGSIZE << order);
+	TRACEPOINT(page_alloc, page2pa(pp), order);
+	return pp;
+}
+
+//
+// Allocates a physical page.  If (alloc_flags & ALLOC_ZERO), fills the entire
+// returned physical page with '\0' bytes.  Does NOT increment the reference
+// count of the page - the caller must do these if necessary (either explicitly
+// or via page_insert).
+//
+// ALLOC_ZERO requests take a page from the zero pool if it has one.
+// Otherwise the page is popped from this CPU's magazine, which is
+// refilled from the free lists in batches of PAGE_MAG_BATCH when it
+// runs empty.
+//
+// Returns NULL if out of free memory.
+//
+struct PageInfo *
+page_alloc(int alloc_flags)
+{
+	struct PageMag *pm = &page_mags[cpunum()];
+	struct PageInfo *pp;
+
+	if ((alloc_flags & ALLOC_ZERO) && zpool.zp_count > 0) {
+		pp = zpool_pop();
+		zpool_stats.hits++;
+	} else {
+		if (pm->pm_count > 0)
+			mag_stats[cpunum()].hits++;
+		else
+			mag_refill(pm);
+
+		if (pm->pm_count > 0) {
+			pp = pm->pm_pages[--pm->pm_count];
+			pp->pp_free = 0;
+			if (alloc_flags & ALLOC_ZERO) {
+				memset(page2kva(pp), 0, PGSIZE);
+				zpool_stats.misses++;
+			}
+		} else if (zpool.zp_count > 0)
+			// the zero pool holds the last free pages
+			pp = zpool_pop();
+		else {
+			buddy_stats.fails++;
+			return NULL;
+		}
+	}
+	TRACEPOINT(page_alloc, page2pa(pp), 0);
+	return pp;
+}
+
+//
+// Zero one free page into the zero pool, unless the pool is full.
+// Called when the kernel has nothing better to do, such as while it
+// waits for a key.  Returns 1 if a page was zeroed, 0 if not.
+//
+int
+page_zero_idle(void)
+{
+	struct PageInfo *pp;
+
+	if (zpool.zp_count == PAGE_ZPOOL_SIZE || !(pp = buddy_alloc(0)))
+		return 0;
+	page_zero(page2kva(pp));
+	pp->pp_free = PP_ZEROED;
+	zpool.zp_pages[zpool.zp_count++] = pp;
+	zpool_stats.zeroed++;
+	return 1;
+}
+
+// Panic unless 'pp' starts an allocated block of 2^order pages that
+// can be freed.
+static void
+page_free_check(struct PageInfo *pp, int order)
+{
+	size_t i = pp - pages;
+
+	if (pp->pp_free)
+		panic("page_free: page %08x is already free", page2pa(pp));
+	if (pp->pp_ref != 0 || pp->pp_link != NULL)
+		panic("page_free: page %08x is in use", page2pa(pp));
+	if (order < 0 || order > PAGE_MAX_ORDER || (i & ((1 << order) - 1)))
+		panic("page_free: page %08x is not a block of order %d",
+		      page2pa(pp), order);
+}
+
+//
+// Return the block of 2^order pages starting at 'pp' to the free
+// lists, merging it with its buddy as far as possible.  The block need
+// not be one that page_alloc_order() returned whole: the pages of a
+// larger block can be freed one at a time.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	if (order == 0) {
+		page_free(pp);
+		return;
+	}
+	page_free_check(pp, order);
+	buddy_free(pp, order);
+}
+
+//
+// Return a page to this CPU's magazine.  A full magazine first drains
+// PAGE_MAG_BATCH pages to the free lists.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free(struct PageInfo *pp)
+{
+	struct PageMag *pm = &page_mags[cpunum()];
+
+	page_free_check(pp, 0);
+	if (pm->pm_count == PAGE_MAG_SIZE)
+		mag_drain(pm, PAGE_MAG_BATCH);
+	pp->pp_free = PP_MAGAZINE;
+	pm->pm_pages[pm->pm_count++] = pp;
+}
+
+//
+// Print the free blocks of each order, the magazines, and the
+// allocator's counters.
+//
+void
+page_stats(void)
+{
+	size_t nfree = 0;
+	int order, i;
+
+	cprintf("order  block   free  allocs   frees\n");
+	for (order = 0; order <= PAGE_MAX_ORDER; order++) {
+		cprintf("%5d %5dK %6u %7u %7u\n", order, (PGSIZE << order) / 1024,
+			free_area[order].fa_nfree, buddy_stats.allocs[order],
+			buddy_stats.frees[order]);
+		nfree += free_area[order].fa_nfree << order;
+	}
+	for (i = 0; i < NCPU; i++) {
+		cprintf("cpu %d magazine: %d pages, %u hits, %u refills, %u drains\n",
+			i, page_mags[i].pm_count, mag_stats[i].hits,
+			mag_stats[i].refills, mag_stats[i].drains);
+		nfree += page_mags[i].pm_count;
+	}
+	cprintf("zero pool: %d pages, %u hits, %u misses, %u zeroed\n",
+		zpool.zp_count, zpool_stats.hits, zpool_stats.misses,
+		zpool_stats.zeroed);
+	nfree += zpool.zp_count;
+	cprintf("%uK free, %u splits, %u merges, %u failed allocations\n",
+		nfree * PGSIZE / 1024, buddy_stats.splits, buddy_stats.merges,
+		buddy_stats.fails);
+}
+
+//
+// Decrement the reference count on a page,
+// freeing it if there are no more refs.
+//
+void
+page_decref(struct PageInfo* pp)
+{
+	if (--pp->pp_ref == 0)
+		page_free(pp);
+}
+
+// Given 'pgdir', a pointer to a page directory, pgdir_walk returns
+// a pointer to the page table entry (PTE) for linear address 'va'.
+// This requires walking the two-level page table structure.
+//
+// If the relevant page table page doesn't exist yet and 'create' is
+// true, a zeroed one is allocated with page_alloc.  Otherwise
+// pgdir_walk returns NULL.  If a 4MB page maps 'va', there is no
+// page table and pgdir_walk returns the page directory entry itself.
+//
+pte_t *
+pgdir_walk(pde_t *pgdir, const void *va, int create)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *pp;
+
+	if (!(*pde & PTE_P)) {
+		if (!create || !(pp = page_alloc(ALLOC_ZERO)))
+			return NULL;
+		pp->pp_ref++;
+		*pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
+	}
+	if (*pde & PTE_PS)
+		return pde;
+	return (pte_t *) KADDR(PTE_ADDR(*pde)) + PTX(va);
+}
+
+//
+// Map [va, va+size) of virtual address space to physical [pa, pa+size)
+// in the page table rooted at pgdir.  Size is a multiple of PGSIZE, and
+// va and pa are both page-aligned.
+// Use permission bits perm|PTE_P for the entries.  Where both
+// addresses are 4MB-aligned and 4MB pages are on, one is used instead
+// of a page table.
+//
+// This function is only intended to set up the ``static'' mappings
+// above UTOP.
+//
+static void
+boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm)
+{
+	size_t off = 0;
+	pte_t *pte;
+
+	while (off < size) {
+		if (pse_enabled && (va + off) % PTSIZE == 0
+		    && (pa + off) % PTSIZE == 0 && size - off >= PTSIZE) {
+			pgdir[PDX(va + off)] = (pa + off) | perm | PTE_P | PTE_PS;
+			off += PTSIZE;
+			continue;
+		}
+		if (!(pte = pgdir_walk(pgdir, (void *) (va + off), 1)))
+			panic("boot_map_region: out of memory");
+		*pte = (pa + off) | perm | PTE_P;
+		off += PGSIZE;
+	}
+}
+
+
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
+//
+// Check that the blocks on the free lists are reasonable.
+//
+static void
+check_page_free_list(void)
+{
+	struct PageInfo *pp;
+	char *first_free_page = (char *) boot_alloc(0);
+	size_t i, n, nfree = 0;
+	int order, cpu, j;
+
+	for (order = 0; order <= PAGE_MAX_ORDER; order++) {
+		n = 0;
+		for (pp = free_area[order].fa_list; pp; pp = pp->pp_link) {
+			// check that we didn't corrupt the free list itself
+			assert(pp >= pages);
+			assert(pp + (1 << order) <= pages + npages);
+			assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
+			assert(pp->pp_free == PP_BUDDY && pp->pp_order == order);
+			assert(!pp->pp_link || pp->pp_link->pp_prev == pp);
+
+			// check that the block is aligned and fully merged
+			i = pp - pages;
+			assert((i & ((1 << order) - 1)) == 0);
+			assert(order == PAGE_MAX_ORDER
+			       || (i ^ (1 << order)) >= npages
+			       || pages[i ^ (1 << order)].pp_free != PP_BUDDY
+			       || pages[i ^ (1 << order)].pp_order != order);
+
+			// check a few pages that shouldn't be free
+			for (; i < pp - pages + (1 << order); i++) {
+				assert(i != 0);
+				assert(i * PGSIZE < IOPHYSMEM
+				       || i * PGSIZE >= PADDR(first_free_page));
+				assert(mem_usable(i * PGSIZE));
+				assert(pages[i].pp_ref == 0);
+			}
+			n++;
+		}
+		assert(n == free_area[order].fa_nfree);
+		nfree += n << order;
+	}
+
+	// check the pages in the magazines and the zero pool
+	for (cpu = 0; cpu < NCPU; cpu++)
+		for (j = 0; j < page_mags[cpu].pm_count; j++) {
+			pp = page_mags[cpu].pm_pages[j];
+			assert(pp->pp_free == PP_MAGAZINE && pp->pp_ref == 0);
+			assert(mem_usable(page2pa(pp)));
+			nfree++;
+		}
+	for (j = 0; j < zpool.zp_count; j++) {
+		pp = zpool.zp_pages[j];
+		assert(pp->pp_free == PP_ZEROED && pp->pp_ref == 0);
+		assert(mem_usable(page2pa(pp)));
+		nfree++;
+	}
+
+	assert(nfree > 0);
+	cprintf("check_page_free_list() succeeded!\n");
+}
+
+//
+// Check the physical page allocator (page_alloc(), page_free(),
+// page_alloc_order(), page_free_order(), the magazines, the zero pool
+// and page_init()).
+//
+static void
+check_page_alloc(void)
+{
+	struct PageInfo *pp, *pp0, *pp1, *pp2;
+	struct PageInfo *stolen;
+	struct PageMag *pm = &page_mags[cpunum()];
+	size_t nfree[PAGE_MAX_ORDER + 1];
+	uint32_t hits;
+	int order;
+	char *c;
+	int i;
+
+	// remember how many blocks of each size are free
+	page_reclaim(pm);
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		nfree[order] = free_area[order].fa_nfree;
+
+	// should be able to allocate three pages
+	pp0 = pp1 = pp2 = 0;
+	assert((pp0 = page_alloc(0)));
+	assert((pp1 = page_alloc(0)));
+	assert((pp2 = page_alloc(0)));
+
+	assert(pp0);
+	assert(pp1 && pp1 != pp0);
+	assert(pp2 && pp2 != pp1 && pp2 != pp0);
+	assert(page2pa(pp0) < npages*PGSIZE);
+	assert(page2pa(pp1) < npages*PGSIZE);
+	assert(page2pa(pp2) < npages*PGSIZE);
+
+	// temporarily steal the rest of the free pages, biggest blocks
+	// first; each block's pp_order remembers its size
+	stolen = NULL;
+	for (order = PAGE_MAX_ORDER; order >= 0; order--)
+		while ((pp = page_alloc_order(order, 0))) {
+			pp->pp_link = stolen;
+			stolen = pp;
+		}
+
+	// should be no free memory
+	assert(!page_alloc(0));
+
+	// free and re-allocate?
+	page_free(pp0);
+	page_free(pp1);
+	page_free(pp2);
+	pp0 = pp1 = pp2 = 0;
+	assert((pp0 = page_alloc(0)));
+	assert((pp1 = page_alloc(0)));
+	assert((pp2 = page_alloc(0)));
+	assert(pp0);
+	assert(pp1 && pp1 != pp0);
+	assert(pp2 && pp2 != pp1 && pp2 != pp0);
+	assert(!page_alloc(0));
+
+	// test flags
+	memset(page2kva(pp0), 1, PGSIZE);
+	page_free(pp0);
+	assert((pp = page_alloc(ALLOC_ZERO)));
+	assert(pp && pp0 == pp);
+	c = page2kva(pp);
+	for (i = 0; i < PGSIZE; i++)
+		assert(c[i] == 0);
+
+	// give the stolen blocks back
+	while ((pp = stolen)) {
+		stolen = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free_order(pp, pp->pp_order);
+	}
+
+	// free the pages we took
+	page_free(pp0);
+	page_free(pp1);
+	page_free(pp2);
+
+	// everything should have merged back into the same blocks
+	page_reclaim(pm);
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		assert(free_area[order].fa_nfree == nfree[order]);
+
+	// a page freed on this CPU is the next one it allocates, and
+	// comes straight from the magazine
+	assert((pp0 = page_alloc(0)));
+	assert(pm->pm_count == PAGE_MAG_BATCH - 1);
+	page_free(pp0);
+	hits = mag_stats[cpunum()].hits;
+	assert(page_alloc(0) == pp0);
+	assert(mag_stats[cpunum()].hits == hits + 1);
+	page_free(pp0);
+
+	// a full magazine drains a batch to the free lists
+	while (pm->pm_count < PAGE_MAG_SIZE) {
+		assert((pp = buddy_alloc(0)));
+		page_free(pp);
+	}
+	assert((pp = buddy_alloc(0)));
+	page_free(pp);
+	assert(pm->pm_count == PAGE_MAG_SIZE - PAGE_MAG_BATCH + 1);
+
+	// a page zeroed in idle time is the next one ALLOC_ZERO returns
+	assert((pp0 = buddy_alloc(0)));
+	memset(page2kva(pp0), 1, PGSIZE);
+	buddy_free(pp0, 0);
+	assert(page_zero_idle());
+	hits = zpool_stats.hits;
+	assert((pp = page_alloc(ALLOC_ZERO)));
+	assert(zpool_stats.hits == hits + 1);
+	c = page2kva(pp);
+	for (i = 0; i < PGSIZE; i++)
+		assert(c[i] == 0);
+	page_free(pp);
+
+	// blocks are aligned to their size, and freeing a block one page
+	// at a time merges it back together
+	assert((pp = page_alloc_order(2, 0)));
+	assert(PGNUM(page2pa(pp)) % 4 == 0);
+	for (i = 0; i < 4; i++)
+		assert(pp[i].pp_link == NULL && !pp[i].pp_free);
+	for (i = 0; i < 4; i++)
+		page_free(&pp[i]);
+
+	// a whole 4MB superpage, if there is one
+	if (nfree[PAGE_MAX_ORDER]) {
+		assert((pp = page_alloc_order(PAGE_MAX_ORDER, 0)));
+		assert(page2pa(pp) % PTSIZE == 0);
+		page_free_order(pp, PAGE_MAX_ORDER);
+	}
+	assert(!page_alloc_order(PAGE_MAX_ORDER + 1, 0));
+
+	page_reclaim(pm);
+	for (order = 0; order <= PAGE_MAX_ORDER; order++)
+		assert(free_area[order].fa_nfree == nfree[order]);
+
+	cprintf("check_page_alloc() succeeded!\n");
+}
+
+//
+// Checks that the kernel part of virtual address space
+// has been set up roughly correctly (by mem_init()).
+//
+static void
+check_kern_pgdir(void)
+{
+	uint32_t i;
+	pde_t *pgdir = kern_pgdir;
+
+	// check phys mem
+	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
+		assert(check_va2pa(pgdir, KERNBASE + i) == i);
+
+	// check kernel stack
+	for (i = 0; i < KSTKSIZE; i += PGSIZE)
+		assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE + i) == PADDR(bootstack) + i);
+	assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE - PGSIZE) == ~0);
+
+	cprintf("check_kern_pgdir() succeeded!\n");
+}
+
+// This function returns the physical address of the page containing 'va',
+// defined by the page directory 'pgdir'.  The hardware normally performs
+// this functionality for us!  We define our own version to help check
+// the check_kern_pgdir() function; it shouldn't be used elsewhere.
+
+static physaddr_t
+check_va2pa(pde_t *pgdir, uintptr_t va)
+{
+	pte_t *p;
+
+	pgdir = &pgdir[PDX(va)];
+	if (!(*pgdir & PTE_P))
+		return ~0;
+	if (*pgdir & PTE_PS)
+		return (*pgdir & ~(PTSIZE - 1)) + (va & (PTSIZE - 1) & ~(PGSIZE - 1));
+	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
+	if (!(p[PTX(va)] & PTE_P))
+		return ~0;
+	return PTE_ADDR(p[PTX(va)]);
+}
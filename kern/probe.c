@@ -0,0 +1,238 @@
+// Dynamic function probes.
+//
+// 'probe add <fn>' replaces the first byte of a kernel function with
+// an int3.  When the breakpoint is hit, probe_trap() counts the call,
+// points the function's return address at probe_trampoline so the
+// return can be timed, then puts the original byte back and
+// single-steps it in place before re-arming the breakpoint.
+//
+// Functions that run on the breakpoint path itself cannot be probed.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+
+#include <kern/probe.h>
+#include <kern/kdebug.h>
+
+#define INT3	0xCC
+
+struct Probe {
+	uintptr_t pr_addr;		// probed function, 0 if slot free
+	const char *pr_name;
+	uint8_t pr_insn;		// first byte, displaced by the int3
+	uint64_t pr_calls;
+	uint64_t pr_returns;		// calls timed to their return
+	uint64_t pr_cycles;		// total entry-to-return cycles
+	uint64_t pr_min, pr_max;
+};
+
+// A probed call in progress, whose return address has been replaced
+struct ProbeRet {
+	struct Probe *pr_probe;		// NULL if the probe was deleted
+	uintptr_t pr_ret;		// the real return address
+	uint64_t pr_start;		// TSC at entry
+};
+
+static struct Probe probes[PROBE_MAX];
+static struct ProbeRet probe_rets[PROBE_NRET];
+static int probe_nret;
+static uint32_t probe_missed;		// calls not timed, probe_rets full
+
+// The probe whose first instruction is being single-stepped, and the
+// interrupt flag to restore once it has been
+static struct Probe *probe_stepping;
+static uint32_t probe_stepif;
+
+// Code on the breakpoint path
+static const char * const probe_nofiles[] = {
+	"kern/trap.c", "kern/trapentry.S", "kern/probe.c",
+	"kern/probeentry.S", "kern/trace.c", "kern/traceentry.S",
+	"kern/profile.c", "kern/fprof.c", "kern/kdebug.c",
+};
+
+void probe_trampoline(void);
+uintptr_t probe_return(void);
+
+static void
+probe_poke(uintptr_t addr, uint8_t insn)
+{
+	uint32_t eflags = read_eflags();
+
+	asm volatile("cli");
+	*(volatile uint8_t *) addr = insn;
+	write_eflags(eflags);
+}
+
+static struct Probe *
+probe_find(uintptr_t addr)
+{
+	int i;
+
+	for (i = 0; i < PROBE_MAX; i++)
+		if (probes[i].pr_addr && probes[i].pr_addr == addr)
+			return &probes[i];
+	return NULL;
+}
+
+int
+probe_add(const char *name)
+{
+	struct Eipdebuginfo info;
+	struct Probe *p = NULL;
+	uintptr_t addr;
+	int i;
+
+	if (debuginfo_fn(name, &addr) < 0
+	    || debuginfo_eip(addr, &info) < 0) {
+		cprintf("probe: no function '%s'\n", name);
+		return -1;
+	}
+	for (i = 0; i < ARRAY_SIZE(probe_nofiles); i++)
+		if (strcmp(info.eip_file, probe_nofiles[i]) == 0) {
+			cprintf("probe: %s is in %s, which handles breakpoints\n",
+				name, info.eip_file);
+			return -1;
+		}
+	if (probe_find(addr) || *(uint8_t *) addr == INT3) {
+		cprintf("probe: %s already has a breakpoint\n", name);
+		return -1;
+	}
+	for (i = 0; i < PROBE_MAX && !p; i++)
+		if (!probes[i].pr_addr)
+			p = &probes[i];
+	if (!p) {
+		cprintf("probe: too many probes\n");
+		return -1;
+	}
+
+	memset(p, 0, sizeof(*p));
+	p->pr_addr = addr;
+	p->pr_name = info.eip_fn_name;
+	p->pr_insn = *(uint8_t *) addr;
+	p->pr_min = ~0ULL;
+	probe_poke(addr, INT3);
+	return 0;
+}
+
+int
+probe_del(const char *name)
+{
+	struct Probe *p;
+	uintptr_t addr;
+	int i;
+
+	if (debuginfo_fn(name, &addr) < 0 || !(p = probe_find(addr))) {
+		cprintf("probe: '%s' is not probed\n", name);
+		return -1;
+	}
+	probe_poke(addr, p->pr_insn);
+	// Calls still in progress return normally but go uncounted.
+	for (i = 0; i < probe_nret; i++)
+		if (probe_rets[i].pr_probe == p)
+			probe_rets[i].pr_probe = NULL;
+	p->pr_addr = 0;
+	return 0;
+}
+
+void
+probe_stats(void)
+{
+	struct Probe *p;
+
+	cprintf("function              calls    returns  avg cycles  min cycles  max cycles\n");
+	for (p = probes; p < probes + PROBE_MAX; p++) {
+		if (!p->pr_addr)
+			continue;
+		cprintf("%-16s %10llu %10llu", p->pr_name, p->pr_calls,
+			p->pr_returns);
+		if (p->pr_returns)
+			cprintf(" %11llu %11llu %11llu\n",
+				p->pr_cycles / p->pr_returns, p->pr_min,
+				p->pr_max);
+		else
+			cprintf("\n");
+	}
+	if (probe_missed)
+		cprintf("(%u calls not timed: too many in progress)\n",
+			probe_missed);
+}
+
+// Handle a breakpoint or debug trap caused by a probe.  Returns 1 if
+// the trap was ours, 0 if not.  Runs with interrupts off.
+bool
+probe_trap(struct Trapframe *tf)
+{
+	struct Probe *p;
+	struct ProbeRet *r;
+	uint32_t *retp;
+
+	if (tf->tf_trapno == T_DEBUG) {
+		if (!probe_stepping)
+			return 0;
+		// The displaced instruction has run; re-arm the probe.
+		*(volatile uint8_t *) probe_stepping->pr_addr = INT3;
+		tf->tf_eflags = (tf->tf_eflags & ~FL_TF) | probe_stepif;
+		probe_stepping = NULL;
+		return 1;
+	}
+
+	// After an int3, EIP is just past it.
+	if (tf->tf_trapno != T_BRKPT || !(p = probe_find(tf->tf_eip - 1)))
+		return 0;
+	p->pr_calls++;
+
+	// At the function's first instruction its return address is on
+	// top of the interrupted stack, which is where the kernel-mode
+	// trap frame ends.
+	retp = (uint32_t *) ((char *) tf
+			     + offsetof(struct Trapframe, tf_esp));
+	if (probe_nret < PROBE_NRET) {
+		r = &probe_rets[probe_nret++];
+		r->pr_probe = p;
+		r->pr_ret = *retp;
+		*retp = (uint32_t) probe_trampoline;
+		r->pr_start = read_tsc();
+	} else
+		probe_missed++;
+
+	// Put the original byte back and single-step it with interrupts
+	// off, so nothing else can run past the unarmed probe.
+	*(volatile uint8_t *) p->pr_addr = p->pr_insn;
+	tf->tf_eip = p->pr_addr;
+	probe_stepping = p;
+	probe_stepif = tf->tf_eflags & FL_IF;
+	tf->tf_eflags = (tf->tf_eflags | FL_TF) & ~FL_IF;
+	return 1;
+}
+
+// Called by probe_trampoline when a probed function returns.  Records
+// the call's latency and returns the address it should have returned
+// to.  Calls return in the reverse order they were made, so the
+// latest entry of probe_rets is this one.
+uintptr_t
+probe_return(void)
+{
+	uint64_t now = read_tsc(), t;
+	struct ProbeRet *r;
+	struct Probe *p;
+	uint32_t eflags;
+	uintptr_t ret;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	assert(probe_nret > 0);
+	r = &probe_rets[--probe_nret];
+	if ((p = r->pr_probe) != NULL) {
+		t = now - r->pr_start;
+		p->pr_returns++;
+		p->pr_cycles += t;
+		p->pr_min = MIN(p->pr_min, t);
+		p->pr_max = MAX(p->pr_max, t);
+	}
+	ret = r->pr_ret;
+	write_eflags(eflags);
+	return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef JOS_KERN_PROBE_H
+#define JOS_KERN_PROBE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Trapframe;
+
+#define PROBE_MAX	16	// probes active at once
+#define PROBE_NRET	64	// probed calls in progress at once
+
+int probe_add(const char *name);
+int probe_del(const char *name);
+void probe_stats(void);
+bool probe_trap(struct Trapframe *tf);
+
+#endif	// !JOS_KERN_PROBE_H
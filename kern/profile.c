@@ -0,0 +1,204 @@
+// Timer-driven sampling profiler.
+//
+// While profiling is on, every timer interrupt records the interrupted
+// EIP, and optionally the return addresses of the frames above it, in
+// a preallocated per-CPU buffer.  Nothing is symbolised until a report
+// is asked for.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/profile.h>
+#include <kern/trap.h>
+#include <kern/kclock.h>
+#include <kern/kdebug.h>
+#include <kern/cpu.h>
+
+#define PROF_NFUNCS	256	// most distinct functions in a report
+
+struct ProfSample {
+	uint32_t ps_depth;		// valid entries in ps_pcs
+	uint32_t ps_pcs[PROF_DEPTH];	// interrupted EIP, then callers
+};
+
+static struct ProfBuf {
+	uint32_t pb_nsamples;
+	uint32_t pb_ndropped;		// samples lost to a full buffer
+	struct ProfSample pb_samples[PROF_NSAMPLES];
+} prof_bufs[NCPU];
+
+static struct {
+	volatile bool running;
+	int hz;
+	int depth;
+	uint32_t eflags;		// EFLAGS before profile_start()
+} prof;
+
+// Per-function totals, built by profile_report()
+static struct ProfFunc {
+	uintptr_t pf_addr;
+	const char *pf_name;
+	int pf_namelen;
+	uint32_t pf_self;		// samples with the EIP in this function
+	uint32_t pf_total;		// samples with this function on the stack
+} prof_funcs[PROF_NFUNCS];
+static int prof_nfuncs;
+
+// Start sampling 'hz' times a second, recording up to 'depth' frames
+// per sample.  Discards the samples of any earlier run.  Interrupts
+// are enabled until profile_stop().
+void
+profile_start(int hz, int depth)
+{
+	int i;
+
+	profile_stop();
+	for (i = 0; i < NCPU; i++) {
+		prof_bufs[i].pb_nsamples = 0;
+		prof_bufs[i].pb_ndropped = 0;
+	}
+	prof.hz = hz;
+	prof.depth = MAX(1, MIN(depth, PROF_DEPTH));
+	prof.running = 1;
+	prof.eflags = read_eflags();
+	kclock_start(hz);
+	write_eflags(prof.eflags | FL_IF);
+}
+
+void
+profile_stop(void)
+{
+	if (!prof.running)
+		return;
+	kclock_stop();
+	prof.running = 0;
+	if (!(prof.eflags & FL_IF))
+		write_eflags(read_eflags() & ~FL_IF);
+}
+
+// Record one sample.  Called from the timer interrupt.
+void
+profile_tick(struct Trapframe *tf)
+{
+	struct ProfBuf *buf = &prof_bufs[cpunum()];
+	struct ProfSample *s;
+
+	if (!prof.running)
+		return;
+	if (buf->pb_nsamples == PROF_NSAMPLES) {
+		buf->pb_ndropped++;
+		return;
+	}
+	s = &buf->pb_samples[buf->pb_nsamples++];
+	s->ps_pcs[0] = tf->tf_eip;
+	s->ps_depth = 1 + stack_capture(s->ps_pcs + 1, prof.depth - 1,
+					tf->tf_regs.reg_ebp);
+}
+
+// Find or add the report entry for the function containing 'pc'.
+static struct ProfFunc *
+prof_func(uintptr_t pc)
+{
+	struct Eipdebuginfo info;
+	int i;
+
+	debuginfo_eip(pc, &info);
+	for (i = 0; i < prof_nfuncs; i++)
+		if (prof_funcs[i].pf_addr == info.eip_fn_addr)
+			return &prof_funcs[i];
+	if (prof_nfuncs == PROF_NFUNCS)
+		return NULL;
+	prof_funcs[i].pf_addr = info.eip_fn_addr;
+	prof_funcs[i].pf_name = info.eip_fn_name;
+	prof_funcs[i].pf_namelen = info.eip_fn_namelen;
+	prof_funcs[i].pf_self = prof_funcs[i].pf_total = 0;
+	prof_nfuncs++;
+	return &prof_funcs[i];
+}
+
+// Print the 'top' functions with the most samples.
+void
+profile_report(int top)
+{
+	struct ProfBuf *buf;
+	struct ProfSample *s;
+	struct ProfFunc *f, *seen[PROF_DEPTH], tmp;
+	uint32_t nsamples = 0, ndropped = 0, lost = 0;
+	int c, i, j, k, n;
+
+	prof_nfuncs = 0;
+	for (c = 0; c < NCPU; c++) {
+		buf = &prof_bufs[c];
+		nsamples += buf->pb_nsamples;
+		ndropped += buf->pb_ndropped;
+		for (i = 0; i < buf->pb_nsamples; i++) {
+			s = &buf->pb_samples[i];
+			// Count each function once per sample toward its
+			// total, even if it recurses.
+			for (j = n = 0; j < s->ps_depth; j++) {
+				if (!(f = prof_func(s->ps_pcs[j]))) {
+					lost++;
+					break;
+				}
+				if (j == 0)
+					f->pf_self++;
+				for (k = 0; k < n && seen[k] != f; k++)
+					/* do nothing */;
+				if (k == n) {
+					seen[n++] = f;
+					f->pf_total++;
+				}
+			}
+		}
+	}
+
+	cprintf("%u samples at %d Hz, %u dropped\n", nsamples, prof.hz, ndropped);
+	if (lost)
+		cprintf("(%u frames not counted: more than %d functions)\n",
+			lost, PROF_NFUNCS);
+	if (nsamples == 0)
+		return;
+
+	// Selection sort is fine for a few hundred functions.
+	cprintf("   self  total  function\n");
+	for (i = 0; i < prof_nfuncs && i < top; i++) {
+		for (j = i + 1; j < prof_nfuncs; j++)
+			if (prof_funcs[j].pf_self > prof_funcs[i].pf_self
+			    || (prof_funcs[j].pf_self == prof_funcs[i].pf_self
+				&& prof_funcs[j].pf_total > prof_funcs[i].pf_total)) {
+				tmp = prof_funcs[i];
+				prof_funcs[i] = prof_funcs[j];
+				prof_funcs[j] = tmp;
+			}
+		f = &prof_funcs[i];
+		cprintf("  %3u%%   %3u%%  %.*s\n",
+			f->pf_self * 100 / nsamples, f->pf_total * 100 / nsamples,
+			f->pf_namelen, f->pf_name);
+	}
+}
+
+// Print every sample as a folded stack, outermost frame first, in the
+// "a;b;c count" format that flame graph tools read.  Identical stacks
+// are summed by those tools, so each sample is printed on its own.
+void
+profile_folded(void)
+{
+	struct ProfBuf *buf;
+	struct ProfSample *s;
+	struct Eipdebuginfo info;
+	int c, i, j;
+
+	for (c = 0; c < NCPU; c++) {
+		buf = &prof_bufs[c];
+		for (i = 0; i < buf->pb_nsamples; i++) {
+			s = &buf->pb_samples[i];
+			for (j = s->ps_depth - 1; j >= 0; j--) {
+				debuginfo_eip(s->ps_pcs[j], &info);
+				cprintf("%.*s%s", info.eip_fn_namelen,
+					info.eip_fn_name, j ? ";" : " 1\n");
+			}
+		}
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef JOS_KERN_PROFILE_H
+#define JOS_KERN_PROFILE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Trapframe;
+
+#define PROF_NSAMPLES	4096	// samples each CPU's buffer can hold
+#define PROF_DEPTH	8	// most frames recorded per sample
+#define PROF_DEFHZ	1000	// default sampling rate
+
+void profile_start(int hz, int depth);
+void profile_stop(void);
+void profile_tick(struct Trapframe *tf);
+void profile_report(int top);
+void profile_folded(void);
+
+#endif	// !JOS_KERN_PROFILE_H
@@ -0,0 +1,133 @@
+// Static tracepoints.
+//
+// TRACEPOINT() (see kern/trace.h) compiles to a 5-byte NOP and a
+// descriptor in the .tracepoints section.  Enabling a tracepoint
+// rewrites its NOP into a call to its stub, which passes the descriptor
+// to trace_entry (kern/traceentry.S), which passes it and the arguments
+// on to trace_fire() to be logged.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+
+#include <kern/trace.h>
+#include <kern/kdebug.h>
+
+extern struct Tracepoint __TRACEPOINTS_BEGIN__[], __TRACEPOINTS_END__[];
+
+void trace_fire(struct Tracepoint *tp, uint32_t a, uint32_t b, uint32_t c);
+
+struct TraceRec {
+	uint64_t tr_tsc;
+	struct Tracepoint *tr_tp;
+	uint32_t tr_args[3];
+};
+
+static struct TraceRec trace_buf[TRACE_NRECS];
+static uint32_t trace_nrecs;		// records ever written
+
+static const uint8_t trace_nop[5] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+
+// Rewrite the instruction at tp's site.  Interrupts are off while the
+// five bytes are stored, so nothing can run a half-written instruction.
+static void
+trace_patch(struct Tracepoint *tp, bool on)
+{
+	uint8_t insn[5];
+	int32_t rel;
+	uint32_t eflags;
+
+	if (on) {
+		rel = tp->tp_stub - (tp->tp_addr + 5);
+		insn[0] = 0xe8;		// call rel32
+		memmove(insn + 1, &rel, 4);
+	} else
+		memmove(insn, trace_nop, 5);
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	memmove((void *) tp->tp_addr, insn, 5);
+	tp->tp_enabled = on;
+	write_eflags(eflags);
+}
+
+// Enable or disable every tracepoint called 'name', or all of them if
+// 'name' is "all".  Returns the number of sites changed.
+int
+trace_enable(const char *name, bool on)
+{
+	struct Tracepoint *tp;
+	int n = 0;
+
+	for (tp = __TRACEPOINTS_BEGIN__; tp < __TRACEPOINTS_END__; tp++)
+		if (strcmp(name, "all") == 0 || strcmp(name, tp->tp_name) == 0) {
+			if (tp->tp_enabled != on)
+				trace_patch(tp, on);
+			n++;
+		}
+	return n;
+}
+
+// Called by trace_entry from the enabled tracepoint 'tp'.
+void
+trace_fire(struct Tracepoint *tp, uint32_t a, uint32_t b, uint32_t c)
+{
+	struct TraceRec *r;
+	uint32_t eflags;
+
+	// Tracepoints fire from interrupt handlers too.
+	eflags = read_eflags();
+	asm volatile("cli");
+	tp->tp_hits++;
+	r = &trace_buf[trace_nrecs++ & (TRACE_NRECS - 1)];
+	r->tr_tsc = read_tsc();
+	r->tr_tp = tp;
+	r->tr_args[0] = a;
+	r->tr_args[1] = b;
+	r->tr_args[2] = c;
+	write_eflags(eflags);
+}
+
+void
+trace_list(void)
+{
+	struct Tracepoint *tp;
+	struct Eipdebuginfo info;
+
+	for (tp = __TRACEPOINTS_BEGIN__; tp < __TRACEPOINTS_END__; tp++) {
+		debuginfo_eip(tp->tp_addr, &info);
+		cprintf("%-16s %-3s %8u  %s:%d\n", tp->tp_name,
+			tp->tp_enabled ? "on" : "off", tp->tp_hits,
+			info.eip_file, info.eip_line);
+	}
+}
+
+// Print the last 'n' records, oldest first, with the cycles elapsed
+// since the record before.
+void
+trace_dump(int n)
+{
+	struct TraceRec *r;
+	uint64_t prev = 0;
+	uint32_t i, first;
+
+	first = trace_nrecs - MIN((uint32_t) n, MIN(trace_nrecs, TRACE_NRECS));
+	for (i = first; i != trace_nrecs; i++) {
+		r = &trace_buf[i & (TRACE_NRECS - 1)];
+		cprintf("%5u %12llu  %-16s %08x %08x %08x\n", i,
+			i == first ? 0ULL : r->tr_tsc - prev,
+			r->tr_tp->tp_name, r->tr_args[0], r->tr_args[1],
+			r->tr_args[2]);
+		prev = r->tr_tsc;
+	}
+}
+
+void
+trace_clear(void)
+{
+	struct Tracepoint *tp;
+
+	trace_nrecs = 0;
+	for (tp = __TRACEPOINTS_BEGIN__; tp < __TRACEPOINTS_END__; tp++)
+		tp->tp_hits = 0;
+}
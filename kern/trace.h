@@ -0,0 +1,54 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define TRACE_NRECS	1024	// ring buffer size; must be a power of 2
+
+// One per TRACEPOINT() site, collected in the .tracepoints section
+struct Tracepoint {
+	uintptr_t tp_addr;	// address of the site's 5-byte NOP
+	const char *tp_name;
+	uintptr_t tp_stub;	// what an enabled site calls
+	uint32_t tp_hits;	// times fired while enabled
+	uint32_t tp_enabled;
+};
+
+// TRACEPOINT(name, [a, [b, [c]]])
+//
+// Mark a trace event.  While disabled, which is the default, the site
+// is a single 5-byte NOP.  'trace on <name>' patches it into a call
+// that logs the name and up to three word-sized arguments to the trace
+// ring buffer.  The arguments are loaded into registers even when the
+// tracepoint is disabled, so keep them cheap.
+//
+// Each site also gets a stub that pushes the address of its descriptor
+// and jumps to trace_entry, so a firing tracepoint need not search for
+// its descriptor.
+#define TRACEPOINT(name, ...) \
+	TRACEPOINT_(name, ##__VA_ARGS__, 0, 0, 0)
+#define TRACEPOINT_(name, a, b, c, ...)					\
+	asm volatile("1:	.byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n"	\
+		     "	.pushsection .rodata\n"				\
+		     "2:	.asciz \"" #name "\"\n"			\
+		     "	.popsection\n"					\
+		     "	.pushsection .tracepoints, \"aw\"\n"		\
+		     "	.balign 4\n"					\
+		     "3:	.long 1b, 2b, 4f, 0, 0\n"			\
+		     "	.popsection\n"					\
+		     "	.pushsection .text.tracepoint, \"ax\"\n"	\
+		     "4:	pushl $3b\n"					\
+		     "	jmp trace_entry\n"				\
+		     "	.popsection"					\
+		     : : "a" ((uint32_t) (a)), "d" ((uint32_t) (b)),	\
+			 "c" ((uint32_t) (c)))
+
+int trace_enable(const char *name, bool on);
+void trace_list(void);
+void trace_dump(int n);
+void trace_clear(void);
+
+#endif	// !JOS_KERN_TRACE_H
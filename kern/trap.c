@@ -0,0 +1,169 @@
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/trap.h>
+#include <kern/profile.h>
+#include <kern/trace.h>
+#include <kern/probe.h>
+
+/* Interrupt descriptor table.  (Must be built at run time because
+ * shifted function addresses can't be represented in relocation records.)
+ */
+struct Gatedesc idt[256] = { { 0 } };
+struct Pseudodesc idt_pd = {
+	sizeof(idt) - 1, (uint32_t) idt
+};
+
+
+static const char *trapname(int trapno)
+{
+	static const char * const excnames[] = {
+		"Divide error",
+		"Debug",
+		"Non-Maskable Interrupt",
+		"Breakpoint",
+		"Overflow",
+		"BOUND Range Exceeded",
+		"Invalid Opcode",
+		"Device Not Available",
+		"Double Fault",
+		"Coprocessor Segment Overrun",
+		"Invalid TSS",
+		"Segment Not Present",
+		"Stack Fault",
+		"General Protection",
+		"Page Fault",
+		"(unknown trap)",
+		"x87 FPU Floating-Point Error",
+		"Alignment Check",
+		"Machine-Check",
+		"SIMD Floating-Point Exception"
+	};
+
+	if (trapno < ARRAY_SIZE(excnames))
+		return excnames[trapno];
+	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
+		return "Hardware Interrupt";
+	return "(unknown trap)";
+}
+
+
+void
+trap_init(void)
+{
+	extern void th_divide(), th_debug(), th_nmi(), th_brkpt(),
+		th_oflow(), th_bound(), th_illop(), th_device(),
+		th_dblflt(), th_tss(), th_segnp(), th_stack(),
+		th_gpflt(), th_pgflt(), th_fperr(), th_align(),
+		th_mchk(), th_simderr(), th_irq_timer(), th_irq_spurious();
+
+	// Everything is an interrupt gate, so handlers run with
+	// interrupts disabled.  The gates use GD_KT, the kernel code
+	// segment of the GDT that gdt_init() loads.
+	SETGATE(idt[T_DIVIDE], 0, GD_KT, th_divide, 0);
+	SETGATE(idt[T_DEBUG], 0, GD_KT, th_debug, 0);
+	SETGATE(idt[T_NMI], 0, GD_KT, th_nmi, 0);
+	SETGATE(idt[T_BRKPT], 0, GD_KT, th_brkpt, 0);
+	SETGATE(idt[T_OFLOW], 0, GD_KT, th_oflow, 0);
+	SETGATE(idt[T_BOUND], 0, GD_KT, th_bound, 0);
+	SETGATE(idt[T_ILLOP], 0, GD_KT, th_illop, 0);
+	SETGATE(idt[T_DEVICE], 0, GD_KT, th_device, 0);
+	SETGATE(idt[T_DBLFLT], 0, GD_KT, th_dblflt, 0);
+	SETGATE(idt[T_TSS], 0, GD_KT, th_tss, 0);
+	SETGATE(idt[T_SEGNP], 0, GD_KT, th_segnp, 0);
+	SETGATE(idt[T_STACK], 0, GD_KT, th_stack, 0);
+	SETGATE(idt[T_GPFLT], 0, GD_KT, th_gpflt, 0);
+	SETGATE(idt[T_PGFLT], 0, GD_KT, th_pgflt, 0);
+	SETGATE(idt[T_FPERR], 0, GD_KT, th_fperr, 0);
+	SETGATE(idt[T_ALIGN], 0, GD_KT, th_align, 0);
+	SETGATE(idt[T_MCHK], 0, GD_KT, th_mchk, 0);
+	SETGATE(idt[T_SIMDERR], 0, GD_KT, th_simderr, 0);
+
+	SETGATE(idt[IRQ_OFFSET + IRQ_TIMER], 0, GD_KT, th_irq_timer, 0);
+	SETGATE(idt[IRQ_OFFSET + IRQ_SPURIOUS], 0, GD_KT, th_irq_spurious, 0);
+
+	// Per-CPU setup
+	trap_init_percpu();
+}
+
+// Initialize and load the per-CPU IDT state
+void
+trap_init_percpu(void)
+{
+	// Load the IDT
+	lidt(&idt_pd);
+}
+
+void
+print_trapframe(struct Trapframe *tf)
+{
+	cprintf("TRAP frame at %p\n", tf);
+	print_regs(&tf->tf_regs);
+	cprintf("  es   0x----%04x\n", tf->tf_es);
+	cprintf("  ds   0x----%04x\n", tf->tf_ds);
+	cprintf("  trap 0x%08x %s\n", tf->tf_trapno, trapname(tf->tf_trapno));
+	// If this trap was a page fault, print the faulting
+	// linear address.
+	if (tf->tf_trapno == T_PGFLT)
+		cprintf("  cr2  0x%08x\n", rcr2());
+	cprintf("  err  0x%08x\n", tf->tf_err);
+	cprintf("  eip  0x%08x\n", tf->tf_eip);
+	cprintf("  cs   0x----%04x\n", tf->tf_cs);
+	cprintf("  flag 0x%08x\n", tf->tf_eflags);
+}
+
+void
+print_regs(struct PushRegs *regs)
+{
+	cprintf("  edi  0x%08x\n", regs->reg_edi);
+	cprintf("  esi  0x%08x\n", regs->reg_esi);
+	cprintf("  ebp  0x%08x\n", regs->reg_ebp);
+	cprintf("  oesp 0x%08x\n", regs->reg_oesp);
+	cprintf("  ebx  0x%08x\n", regs->reg_ebx);
+	cprintf("  edx  0x%08x\n", regs->reg_edx);
+	cprintf("  ecx  0x%08x\n", regs->reg_ecx);
+	cprintf("  eax  0x%08x\n", regs->reg_eax);
+}
+
+static void
+trap_dispatch(struct Trapframe *tf)
+{
+	switch (tf->tf_trapno) {
+	case T_DEBUG:
+	case T_BRKPT:
+		if (probe_trap(tf))
+			return;
+		break;
+
+	case IRQ_OFFSET + IRQ_TIMER:
+		profile_tick(tf);
+		return;
+
+	// Handle spurious interrupts
+	// The hardware sometimes raises these because of noise on the
+	// IRQ line or other reasons. We don't care.
+	case IRQ_OFFSET + IRQ_SPURIOUS:
+		cprintf("Spurious interrupt on irq 7\n");
+		print_trapframe(tf);
+		return;
+	}
+
+	// Unexpected trap: there is no user mode, so the kernel is at fault.
+	print_trapframe(tf);
+	panic("unhandled trap in kernel");
+}
+
+// Called from _alltraps with the trap frame on the stack.  Returns to
+// the interrupted kernel code.
+void
+trap(struct Trapframe *tf)
+{
+	// The interrupted code may have set DF and some versions
+	// of GCC rely on DF being clear
+	asm volatile("cld" ::: "cc");
+
+	TRACEPOINT(trap, tf->tf_trapno, tf->tf_eip);
+	trap_dispatch(tf);
+}